@@ -0,0 +1,38 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+#include <QVector>
+#include <QLineF>
+
+// 延迟着色的几何缓冲：一个三维图元光栅化后每个像素的位置、深度、单位法向量、纹理坐标及其覆盖范围，
+// 各分量分开连续存放。内容只取决于几何和相机，光照或材质改变时
+// 直接对这些像素重新计算光照，不必重新细分和光栅化
+struct GBuffer
+{
+    GBuffer() : stamp(-1) {}
+
+    void clear()
+    {
+        xs.clear(); ys.clear(); depth.clear();
+        nx.clear(); ny.clear(); nz.clear();
+        us.clear(); vs.clear(); densities.clear();
+    }
+
+    inline void append(int x, int y, float d, float xn, float yn, float zn, float u, float v, float density)
+    {
+        xs.append(x); ys.append(y); depth.append(d);
+        nx.append(xn); ny.append(yn); nz.append(zn);
+        us.append(u); vs.append(v); densities.append(density);
+    }
+
+    int size() const { return xs.size(); }
+
+    int stamp; // 生成时的几何版本号，见Painter::invalidateGeometry
+    QLineF line; // 生成时图元的位置和半径
+    QVector<int> xs, ys;
+    QVector<float> depth; // 规范化设备坐标的z
+    QVector<float> nx, ny, nz;
+    QVector<float> us, vs; // 经纬度纹理坐标，不带纹理的图元为0
+    QVector<float> densities; // 像素覆盖的纹理坐标面积，见Texture::sample
+};
+
+#endif // GBUFFER_H
@@ -7,11 +7,16 @@
 
 
 #include "painter.h"
+#include "rasterizer.h"
+#include "gbuffer.h"
+#include "shadekernel.h"
+#include "texture.h"
 #include <QPainter>
 #include <QPen>
 #include <QBrush>
 #include <QColor>
 #include <QDebug>
+#include <QUrl>
 #include <math.h>
 #include <QTime>
 
@@ -25,6 +30,21 @@ Painter::Painter(QQuickItem *parent)
     , m_pfunc(0), m_era(40), m_erb(20), m_eangle(0)
     , m_beSize(0), m_bsSize(0)
     , m_kochSize(-1)
+    , m_cachedCount(0)
+    , m_bCacheValid(false)
+    , m_baseCount(-1)
+    , m_quality(5)
+    , m_sphereMode(0)
+    , m_bPerspective(false)
+    , m_fov(45)
+    , m_geometryStamp(0)
+    , m_lightTable(0)
+    , m_texture(Texture::checkerboard(16, 8, 32))
+    , m_bSmoothTexture(true)
+    , m_shadingMode(0)
+    , m_lightColor(Qt::white)
+    , m_lightIntensity(228)
+    , m_ambientLight(228)
 {
     m_lThetax = -1;
     m_lThetay = -1;
@@ -44,6 +64,8 @@ Painter::~Painter()
 void Painter::clear()
 {
     purgePaintElements();
+    m_liveRect = QRect();
+    invalidateCache();
     m_beSize = 0;
     m_bsSize = 0;
     m_kochSize = -1;
@@ -55,1440 +77,1246 @@ void Painter::undo()
     if (m_elements.size())
     {
         delete m_elements.takeLast();
+        m_element = 0;
+        m_liveRect = QRect();
+        invalidateCache();
         update();
     }
 }
 
-// Bresenham画直线算法：
-void drawLine(QPainter *painter, QLineF line)
+// 图元在屏幕上的包围盒（含线宽），用于局部刷新
+QRect ElementGroup::boundingRect(int canvasHeight) const
 {
-    int x1, y1, x2, y2;
-    x1 = line.x1(); y1 = line.y1();
-    x2 = line.x2(); y2 = line.y2();
-    int x = x1, y = y1;
-    int dx = abs(x2 - x1), dy = abs(y2 - y1);
-    painter->drawPoint(x, y);
-    painter->drawPoint(x2, y2);
-    if (dx == 0 && y < y2)
+    if (m_lines.isEmpty())
+        return QRect();
+    QLineF line = m_lines.last();
+    QRectF rect;
+    switch (m_pfunc)
     {
-        while (y < y2)
-            painter->drawPoint(x, y++);
-        return;
-    }
-    if (dx == 0 && y > y2)
+    case 2:
     {
-        while (y > y2)
-            painter->drawPoint(x, y--);
-        return;
+        double a = m_eangle * PI / 180.0;
+        double hx = sqrt(m_era * m_era * cos(a) * cos(a) + m_erb * m_erb * sin(a) * sin(a));
+        double hy = sqrt(m_era * m_era * sin(a) * sin(a) + m_erb * m_erb * cos(a) * cos(a));
+        rect = QRectF(line.x2() - hx, line.y2() - hy, 2 * hx, 2 * hy);
+        break;
     }
-    if (dy == 0 && x < x2)
+    case 6:
     {
-        while (x < x2)
-            painter->drawPoint(x++, y);
-        return;
+        // 雪花各级凸起离三角形的距离之和不超过边长的一半
+        double dx = line.x2() - line.x1(), dy = line.y2() - line.y1();
+        double x3 = line.x1() + (dx + dy * sqrt(3)) / 2, y3 = line.y1() + (dy - sqrt(3) * dx) / 2;
+        double xmin = mymin(mymin(line.x1(), line.x2()), x3), xmax = mymax(mymax(line.x1(), line.x2()), x3);
+        double ymin = mymin(mymin(line.y1(), line.y2()), y3), ymax = mymax(mymax(line.y1(), line.y2()), y3);
+        double pad = line.length() / 2 + mymax(m_kochSize, 0);
+        rect = QRectF(xmin - pad, ymin - pad, xmax - xmin + 2 * pad, ymax - ymin + 2 * pad);
+        break;
     }
-    if (dy == 0 && x > x2)
+    case 7:
+        // 蕨类植物迭代函数系统的吸引子范围约为x∈[-2.2, 2.7]，y∈[0, 10]
+        rect = QRectF(line.x1() - 70, line.y1(), 155, 305);
+        break;
+    case 8:
+    case 9:
     {
-        while (x > x2)
-            painter->drawPoint(x--, y);
-        return;
+        double radius = line.length();
+        radius = (radius > canvasHeight / 4) ? canvasHeight / 4 : radius;
+        rect = QRectF(line.x1() - radius, line.y1() - radius, 2 * radius, 2 * radius);
+        break;
     }
-    if (dx == dy && y < y2)
-    {
-        while (x < x2)
-            painter->drawPoint(x++, y++);
-        while (x > x2)
-            painter->drawPoint(x--, y++);
-        return;
-    }
-    if (dx == dy && y > y2)
-    {
-        while (x < x2)
-            painter->drawPoint(x++, y--);
-        while (x > x2)
-            painter->drawPoint(x--, y--);
-        return;
+    default:
+        rect = QRectF(line.p1(), line.p2()).normalized();
     }
+    int pad = m_pen.width() / 2 + 2;
+    return rect.toAlignedRect().adjusted(-pad, -pad, pad, pad);
+}
 
-    if (dy < dx)
+//koch曲线：只生成线段，由drawLines批量光栅化
+static void Koch(QVector<QLineF> &segments, QLineF line, int n)
+{
+    int x1 = line.x1(), y1 = line.y1();
+    int x2 = line.x2(), y2 = line.y2();
+    if (n == 0)
     {
-        int p = 2 * dy - dx;
-        int dy2 = 2 * dy, dymdx2 = 2 * (dy - dx);
-        if (x < x2)
-        while (x < x2)
-        {
-            x++;
-            if (p < 0)
-            {
-                p += dy2;
-            }
-            else
-            {
-                if ((y2 - y1) < 0)
-                    y--;
-                else
-                    y++;
-                p += dymdx2;
-            }
-            painter->drawPoint(x, y);
-        }
-        else
-        while (x > x2)
-        {
-            x--;
-            if (p < 0)
-            {
-                p += dy2;
-            }
-            else
-            {
-                if ((y2 - y1) < 0)
-                    y--;
-                else
-                    y++;
-                p += dymdx2;
-            }
-            painter->drawPoint(x, y);
-        }
+        segments.append(line);
         return;
     }
     else
     {
-        int p = 2 * dx - dy;
-        int dy2 = 2 * dx, dymdx2 = 2 * (dx - dy);
-        if (y < y2)
-            while (y < y2)
-            {
-                y++;
-                if (p < 0)
-                {
-                    p += dy2;
-                }
-                else
-                {
-                    if ((x2 - x1) < 0)
-                        x--;
-                    else
-                        x++;
-                    p += dymdx2;
-                }
-                painter->drawPoint(x, y);
-        }
-        else
-        {
-            while (y > y2)
-            {
-                y--;
-                if (p < 0)
-                {
-                    p += dy2;
-                }
-                else
-                {
-                    if ((x2 - x1) < 0)
-                        x--;
-                    else
-                        x++;
-                    p += dymdx2;
-                }
-                painter->drawPoint(x, y);
-            }
-        }
+        int dx = (x2 - x1) / 3, dy = (y2 - y1) / 3;
+        int x11 = x1 + dx, y11 = y1 + dy;
+        int x12 = x2 - dx, y12 = y2 - dy;
+        int x13 = x11 + (dx - sqrt(3) * dy) / 2;
+        int y13 = y11 + (dx * sqrt(3) + dy) / 3;
+
+        QLineF tmp;
+        QPoint tmpp1, tmpp2;
+        tmpp1.setX(x11); tmpp1.setY(y11);
+        tmp.setP1(line.p1()); tmp.setP2(tmpp1);
+        Koch(segments, tmp, n - 1);
+        tmpp2.setX(x13); tmpp2.setY(y13);
+        tmp.setP1(tmpp1); tmp.setP2(tmpp2);
+        Koch(segments, tmp, n - 1);
+        tmpp1.setX(x12); tmpp1.setY(y12);
+        tmp.setP1(tmpp2); tmp.setP2(tmpp1);
+        Koch(segments, tmp, n - 1);
+        tmp.setP1(tmpp1); tmp.setP2(line.p2());
+        Koch(segments, tmp, n - 1);
     }
 }
 
+// 椭圆填充：逐行解旋转椭圆方程，见fillEllipse。只处理画布内、线宽外扩后的裁剪区内的行
+void fill_ellipse(RasterTarget *target, int x1, int y1, int xc, int yc, float ra, float rb, float ang)
+{
+    QRect clip = target->strokeClipRect() & QRect(0, 0, target->width(), target->height());
+    fillEllipse(*target, x1, y1, xc, yc, ra, rb, ang, clip);
+}
 
-QPointF rotate(int x, int y, float cosa, float sina)
+Point3D getN(double vx, double vy, double vz, double nx, double ny, double nz)
 {
-    int xt = x;
-    QPointF p;
-    p.setX(x * cosa + y * sina);
-    p.setY(y * cosa - xt * sina);
+    double tmp = sqrt((vy * nz - vz * ny) * (vy * nz - vz * ny) +
+                      (nx * vz - vx * nz) * (vz * nx - vx * nz) +
+                      (vx * ny - vy * nx) * (vx * ny - nx * vy));
+    Point3D p;
+    p.x = (vy * nz - vz * ny) / tmp;
+    p.y = (nx * vz - vx * nz) / tmp;
+    p.z = (vx * ny - vy * nx) / tmp;
     return p;
 }
 
-// 中点画椭圆算法
-void drawEllipse(QPainter *painter, QLineF line, int rx, int ry, int ang)
+// 投影平面的两个坐标轴：屏幕x轴u和y轴v，都与观察方向n垂直
+void viewBasis(double nx, double ny, double nz, Point3D &u, Point3D &v)
+{
+    double ux = 0, uy = 1.0, uz = 0;
+    if (ux == nx && ny == uy && nz == uz)
+        ux++;
+    u.x = ux; u.y = uy; u.z = uz;
+    if (fabs(ux * nx + uy * ny + uz * nz) != 0)
+        u = getN(ux, uy, uz, nx, ny, nz);
+    v = getN(u.x, u.y, u.z, nx, ny, nz);
+}
+
+// 批量变换：整个顶点数组按分量连续读写，一遍乘以模型-视图-投影矩阵得到裁剪坐标，
+// 再透视除法得到屏幕坐标和深度。共用顶点只变换一次，不再随三角形数重复
+void transformVertices(const SphereMesh &mesh, const QMatrix4x4 &mvp, const Camera &camera,
+                       QVector<float> &clip, QVector<float> &screen)
 {
-    float cosa = cos(ang * PI / 180.0);
-    float sina = sin(ang * PI / 180.0);
-    int xc = line.x2(), yc = line.y2();
-    sina = (abs(sina) < 1e-3) ? 0 : sina;
-    cosa = (abs(cosa) < 1e-3) ? 0 : cosa;
-    int x = 0, y = ry;
-    QPointF p = rotate(x, y, cosa, sina);
-    int xx = p.x(), yy = p.y();
-    painter->drawPoint(xc + xx, yc + yy);
-    p = rotate(x, -y, cosa, sina);
-    xx = p.x(), yy = p.y();
-    painter->drawPoint(xc + xx, yc + yy);
-    p = rotate(-x, y, cosa, sina);
-    xx = p.x(), yy = p.y();
-    painter->drawPoint(xc + xx, yc + yy);
-    p = rotate(-x, -y, cosa, sina);
-    xx = p.x(), yy = p.y();
-    painter->drawPoint(xc + xx, yc + yy);
-
-    int rx2 = rx * rx, ry2 = ry * ry;
-    int tworx2 = 2 * rx2, twory2 = 2 * ry2;
-    int p1 = ry * ry - rx * rx * ry - rx * rx / 4;
-    int px = 0, py = tworx2 * y;
-
-    while (px < py)
+    int count = mesh.xs.size();
+    clip.resize(count * 4);
+    screen.resize(count * 3);
+    float m[4][4];
+    for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 4; c++)
+            m[r][c] = mvp(r, c);
+
+    const float *x = mesh.xs.constData(), *y = mesh.ys.constData(), *z = mesh.zs.constData();
+    float *cx = clip.data(), *cy = cx + count, *cz = cy + count, *cw = cz + count;
+    for (int i = 0; i < count; i++)
     {
-        x++;
-        px += twory2;
-        if (p1 < 0)
-        {
-            p1 += px + ry2;
-        }
-        else
-        {
-            y--;
-            py -= tworx2;
-            p1 += px - py + ry2;
-        }
+        cx[i] = m[0][0] * x[i] + m[0][1] * y[i] + m[0][2] * z[i] + m[0][3];
+        cy[i] = m[1][0] * x[i] + m[1][1] * y[i] + m[1][2] * z[i] + m[1][3];
+        cz[i] = m[2][0] * x[i] + m[2][1] * y[i] + m[2][2] * z[i] + m[2][3];
+        cw[i] = m[3][0] * x[i] + m[3][1] * y[i] + m[3][2] * z[i] + m[3][3];
+    }
 
-        p = rotate(x, y, cosa, sina);
-        xx = p.x(), yy = p.y();
-        painter->drawPoint(xc + xx, yc + yy);
-        p = rotate(x, -y, cosa, sina);
-        xx = p.x(), yy = p.y();
-        painter->drawPoint(xc + xx, yc + yy);
-        p = rotate(-x, y, cosa, sina);
-        xx = p.x(), yy = p.y();
-        painter->drawPoint(xc + xx, yc + yy);
-        p = rotate(-x, -y, cosa, sina);
-        xx = p.x(), yy = p.y();
-        painter->drawPoint(xc + xx, yc + yy);
+    // 视点后方的顶点（w <= 0）屏幕坐标无意义，用到它的三角形会先按近平面裁剪
+    float hw = camera.width / 2.0f, hh = camera.height / 2.0f;
+    float *sx = screen.data(), *sy = sx + count, *sz = sy + count;
+    for (int i = 0; i < count; i++)
+    {
+        float inv = cw[i] > 0 ? 1 / cw[i] : 0;
+        sx[i] = (cx[i] * inv + 1) * hw;
+        sy[i] = (cy[i] * inv + 1) * hh;
+        sz[i] = cz[i] * inv;
     }
+}
 
-    int p2 = round(ry2 * (x + 1/2) * (x + 1/2) + rx2 * (y - 1) * (y - 1) - rx2 * ry2);
-    while (y > 0)
+// 裁剪空间中的顶点，带着要插值的法向量
+struct ClipVertex
+{
+    float x, y, z, w;
+    QVector3D n;
+    float u, v; // 纹理坐标
+    float I[3]; // 各通道的亮度
+};
+
+// 按近平面(z >= -w)裁剪三角形（Sutherland-Hodgman），返回结果顶点数，最多4个
+static int clipNear(const ClipVertex *in, ClipVertex *out)
+{
+    int count = 0;
+    for (int i = 0; i < 3; i++)
     {
-        y--;
-        py -= tworx2;
-        if (p2 > 0)
-        {
-            p2 += rx2 - py;
-        }
-        else
+        const ClipVertex &a = in[i], &b = in[(i + 1) % 3];
+        float da = a.z + a.w, db = b.z + b.w;
+        if (da >= 0)
+            out[count++] = a;
+        if ((da >= 0) != (db >= 0))
         {
-            x++;
-            px += twory2;
-            p2 += px - py + rx2;
+            float t = da / (da - db);
+            ClipVertex &c = out[count++];
+            c.x = a.x + t * (b.x - a.x);
+            c.y = a.y + t * (b.y - a.y);
+            c.z = a.z + t * (b.z - a.z);
+            c.w = a.w + t * (b.w - a.w);
+            c.n = a.n + (b.n - a.n) * t;
+            c.u = a.u + t * (b.u - a.u);
+            c.v = a.v + t * (b.v - a.v);
+            for (int k = 0; k < 3; k++)
+                c.I[k] = a.I[k] + t * (b.I[k] - a.I[k]);
         }
+    }
+    return count;
+}
 
-        p = rotate(x, y, cosa, sina);
-        xx = p.x(), yy = p.y();
-        painter->drawPoint(xc + xx, yc + yy);
-        p = rotate(x, -y, cosa, sina);
-        xx = p.x(), yy = p.y();
-        painter->drawPoint(xc + xx, yc + yy);
-        p = rotate(-x, y, cosa, sina);
-        xx = p.x(), yy = p.y();
-        painter->drawPoint(xc + xx, yc + yy);
-        p = rotate(-x, -y, cosa, sina);
-        xx = p.x(), yy = p.y();
-        painter->drawPoint(xc + xx, yc + yy);
+QPointF Camera::project(double x, double y, double z) const
+{
+    float cx = projection(0, 0) * x + projection(0, 1) * y + projection(0, 2) * z + projection(0, 3);
+    float cy = projection(1, 0) * x + projection(1, 1) * y + projection(1, 2) * z + projection(1, 3);
+    float cw = projection(3, 0) * x + projection(3, 1) * y + projection(3, 2) * z + projection(3, 3);
+    return QPointF((cx / cw + 1) * width / 2, (cy / cw + 1) * height / 2);
+}
+
+// 与sphere()相同的半径：拖动长度，不超过画布高度的1/4
+static double sphereRadius(const QLineF &line, int height)
+{
+    double x1 = line.x1(), y1 = line.y1();
+    int x2 = line.x2(), y2 = line.y2();
+    double radius = sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
+    return (radius > height / 4) ? height / 4 : radius;
+}
+
+// 球在屏幕上的包围盒：外切立方体8个角投影后的范围。平行投影下就是圆盘的外接正方形，
+// 透视投影下离视点近的部分会放大
+QRectF sphereBounds(const Camera &camera, int cx, int cy, double radius)
+{
+    double left = 1e9, right = -1e9, top = 1e9, bottom = -1e9;
+    for (int k = 0; k < 8; k++)
+    {
+        QPointF p = camera.project(cx + ((k & 1) ? radius : -radius),
+                                   cy + ((k & 2) ? radius : -radius),
+                                   (k & 4) ? radius : -radius);
+        left = mymin(left, p.x());
+        right = mymax(right, p.x());
+        top = mymin(top, p.y());
+        bottom = mymax(bottom, p.y());
     }
+    return QRectF(left, top, right - left, bottom - top);
+}
+
+
+// 由球面自身坐标中的单位法向量求经纬度纹理坐标，与网格顶点上的纹理坐标一致
+static inline void sphereUV(float xn, float yn, float zn, float &u, float &v)
+{
+    u = atan2(yn, xn) / (2 * PI);
+    u = u < 0 ? u + 1 : u;
+    v = acos(mymax(-1.0f, mymin(zn, 1.0f))) / PI;
 }
 
-// 椭圆填充
+// 三角形内每个像素覆盖的纹理坐标面积（见Texture::sample），取三角形在纹理坐标中和屏幕上的面积之比。
+// v0、v1、v2为着色器插值的顶点属性，其中第4、5、6个分量为u/w、v/w和1/w
+static float triangleDensity(const float *v0, const float *v1, const float *v2,
+                             const QPointF &q0, const QPointF &q1, const QPointF &q2)
+{
+    float u0 = v0[4] / v0[6], u1 = v1[4] / v1[6], u2 = v2[4] / v2[6];
+    float t0 = v0[5] / v0[6], t1 = v1[5] / v1[6], t2 = v2[5] / v2[6];
+    double uv = fabs((u1 - u0) * (t2 - t0) - (u2 - u0) * (t1 - t0));
+    double screen = fabs((q1.x() - q0.x()) * (q2.y() - q0.y()) - (q2.x() - q0.x()) * (q1.y() - q0.y()));
+    return 0.5 * log2(mymax(uv, 1e-12) / mymax(screen, 1e-6));
+}
 
-void fill_ellipse(QPainter *painter, int x1, int y1, int xc, int yc, float ra, float rb, float ang, bool** mask)
+// 几何阶段的三角形着色器：法向量、深度和纹理坐标在屏幕上都是平面方程，每个三角形求一次
+// 第二、第三个顶点相对第一个顶点的差值，每段起点代入重心坐标，段内逐像素只做加法，
+// 归一化后写进几何缓冲，不计算光照。
+// 透视投影下顶点属性在屏幕上并不线性变化，除以w之后才是。法向量归一化时会消去这个权重，
+// 所以顶点法向量预先除以w就得到透视校正的插值；纹理坐标则同时插值1/w，逐像素除回来。
+// 深度（规范化设备坐标）本身在屏幕上线性
+struct SphereGeometry
 {
-    float cosa = cos(ang * PI / 180.0);
-    float sina = sin(ang * PI / 180.0);
-    sina = (abs(sina) < 1e-3) ? 0 : sina;
-    cosa = (abs(cosa) < 1e-3) ? 0 : cosa;
-
-    QStack<QPointF> s;
-    s.append(QPointF(x1, y1));
-    QPointF p, ptmp;
-    int x0, y0, xl, x, y, xtmp, ytmp;
-    while(!s.empty())
+    GBuffer *g;
+    float a0[7]; // 第一个顶点的nx/w、ny/w、nz/w、深度、u/w、v/w和1/w
+    float a1[7], a2[7]; // 第二、第三个顶点与第一个顶点之差
+    float density; // 三角形内每个像素覆盖的纹理坐标面积，见Texture::sample
+    bool textured;
+
+    void beginFace(const QVector3D &) {}
+
+    void setTriangle(const float *v0, const float *v1, const float *v2,
+                     const QPointF &q0, const QPointF &q1, const QPointF &q2)
     {
-        p = s.last(); s.pop_back();
-        qDebug() << p.x() << p.y();
-        x = p.x(); y = p.y();
-        painter->drawPoint(p);
-        mask[y][x] = 1;
-        x0 = x + 1;
-        y0 = y;
-        ptmp = rotate(x0 - xc, y0 - yc, cosa, -sina);
-        xtmp = ptmp.x(); ytmp = ptmp.y();
-        qDebug() << x0 << y0 << xtmp << ytmp << ra << rb;
-        while (x0 < 1040 && !mask[y0][x0] && (xtmp * xtmp / (ra * ra) + ytmp * ytmp / (rb * rb)) < 1)
+        int n = textured ? 7 : 4;
+        for (int i = 0; i < n; i++)
         {
-            painter->drawPoint(QPointF(x0, y0));
-            mask[y0][x0] = 1;
-            x0++;
-            ptmp = rotate(x0 - xc, y0 - yc, cosa, -sina);
-            xtmp = ptmp.x(); ytmp = ptmp.y();
+            a0[i] = v0[i];
+            a1[i] = v1[i] - v0[i];
+            a2[i] = v2[i] - v0[i];
         }
+        density = textured ? triangleDensity(v0, v1, v2, q0, q1, q2) : 0;
+    }
 
-        x0 = x - 1;
-        ptmp = rotate(x0 - xc, y0 - yc, cosa, -sina);
-        xtmp = ptmp.x(); ytmp = ptmp.y();
-        while (x0 >= 0 && !mask[y0][x0] && (xtmp * xtmp / (ra * ra) + ytmp * ytmp / (rb * rb)) < 1)
+    void span(int y, int x0, int x1, const Barycentric &b)
+    {
+        int n = textured ? 7 : 4;
+        float s[7], d[7];
+        for (int i = 0; i < n; i++)
         {
-            painter->drawPoint(QPointF(x0, y0));
-            mask[y0][x0] = 1;
-            x0--;
-            ptmp = rotate(x0 - xc, y0 - yc, cosa, -sina);
-            xtmp = ptmp.x(); ytmp = ptmp.y();
+            s[i] = a0[i] + b.l1 * a1[i] + b.l2 * a2[i];
+            d[i] = b.dl1 * a1[i] + b.dl2 * a2[i];
         }
-        xl = x0 + 1;
-
-        x = xl;
-        ptmp = rotate(x - xc, y0 + 1 - yc, cosa, -sina);
-        xtmp = ptmp.x(); ytmp = ptmp.y();
-
+        for (int x = x0; x <= x1; x++)
         {
-            while (x < 1040 && ((xtmp * xtmp / (ra * ra) + ytmp * ytmp / (rb * rb)) >= 1 || mask[y0 + 1][x]))
+            float inv = 1 / sqrt(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]);
+            float xn = s[0] * inv, yn = s[1] * inv, zn = s[2] * inv;
+            float u = 0, v = 0;
+            if (textured)
             {
-                x++;
-                ptmp = rotate(x - xc, y0 + 1 - yc, cosa, -sina);
-                xtmp = ptmp.x(); ytmp = ptmp.y();
+                float w = 1 / s[6];
+                u = s[4] * w;
+                v = s[5] * w;
+                s[4] += d[4]; s[5] += d[5]; s[6] += d[6];
             }
-            if (y0 + 1 <= 665 && !mask[y0 + 1][x] && (xtmp * xtmp / (ra * ra) + ytmp * ytmp / (rb * rb)) < 1)
-                s.push_back(QPointF(x, y0 + 1));
+            g->append(x, y, s[3], xn, yn, zn, u, v, density);
+            s[0] += d[0]; s[1] += d[1]; s[2] += d[2]; s[3] += d[3];
+        }
+    }
+};
+
+// 解析球面：不需要任何三角形，逐像素求视线与球面的交点。
+// 平行投影下球的投影是以(cx, cy)为圆心的圆盘，逐行直接求出盘内的像素区间，
+// 像素相对圆心的偏移就是单位法向量在屏幕两轴u、v上的分量乘以半径，
+// 朝向观察者的第三个分量由单位长度解出；透视投影下对每个像素解视线与球面的二次方程，
+// 取近的交点。得到的法向量都在相机坐标里，按u、v、n换回球面自身的坐标。各行之间互不依赖。
+// 交点的深度与三角网格模式一样取规范化设备坐标的z
+void sphereDisc(GBuffer &g, const Camera &camera, int cx, int cy, double radius,
+                float vx, float vy, float vz, bool textured, const QRect &clip)
+{
+    // 半径为0时没有像素，也不能求倒数
+    if (radius <= 0)
+        return;
+    Point3D u, v;
+    viewBasis(vx, vy, vz, u, v);
+    QRect rows = sphereBounds(camera, cx, cy, radius).toAlignedRect().adjusted(-1, -1, 1, 1) & clip;
+    float inv = 1 / radius;
+
+    // 画布坐标中的点投影后的深度
+    const QMatrix4x4 &P = camera.projection;
+    float zx = P(2, 0), zy = P(2, 1), zz = P(2, 2), zw = P(2, 3);
+    float wx = P(3, 0), wy = P(3, 1), wz = P(3, 2), ww = P(3, 3);
+
+    // 透视投影的视线从视点出发，m为视点相对球心的位置
+    double mx = camera.width / 2.0 - cx, my = camera.height / 2.0 - cy, mz = camera.distance;
+    double mm = mx * mx + my * my + mz * mz - radius * radius;
+    for (int y = rows.top(); y <= rows.bottom(); y++)
+    {
+        float b = (y - cy) * inv;
+        int xl = rows.left(), xr = rows.right();
+        if (!camera.perspective)
+        {
+            if (fabs(y - cy) > radius)
+                continue;
+            double half = radius * sqrt(mymax(1 - double(b) * b, 0.0));
+            xl = mymax(int(ceil(cx - half)), clip.left());
+            xr = mymin(int(floor(cx + half)), clip.right());
         }
-        x = xl;
-        ptmp = rotate(x - xc, y0 - 1 - yc, cosa, -sina);
-        xtmp = ptmp.x(); ytmp = ptmp.y();
 
-       {
-            while (x < 1040 && ((xtmp * xtmp / (ra * ra) + ytmp * ytmp / (rb * rb)) >= 1 || mask[y0 - 1][x] ))
+        // 视线方向d指向画布上的像素(x, y, 0)，交点为m + t·d，|m + t·d| = radius
+        double dy = y - camera.height / 2.0, dz = -camera.distance;
+        for (int x = xl; x <= xr; x++)
+        {
+            float a, bb, w, X, Y, Z;
+            if (!camera.perspective)
+            {
+                // 本行法向量的v分量不变，沿x每走一个像素u分量增加1/radius
+                a = (x - cx) * inv;
+                bb = b;
+                w = sqrtf(mymax(1 - a * a - b * b, 0.0f));
+                X = x; Y = y; Z = radius * w;
+            }
+            else
+            {
+                double dx = x - camera.width / 2.0;
+                double dd = dx * dx + dy * dy + dz * dz;
+                double md = mx * dx + my * dy + mz * dz;
+                double disc = md * md - dd * mm;
+                if (disc < 0)
+                    continue;
+                double t = (-md - sqrt(disc)) / dd;
+                X = camera.width / 2.0 + t * dx; Y = camera.height / 2.0 + t * dy; Z = camera.distance + t * dz;
+                a = (mx + t * dx) * inv; bb = (my + t * dy) * inv; w = (mz + t * dz) * inv;
+            }
+            float d = (zx * X + zy * Y + zz * Z + zw) / (wx * X + wy * Y + wz * Z + ww);
+            float xn = a * u.x + bb * v.x + w * vx;
+            float yn = a * u.y + bb * v.y + w * vy;
+            float zn = a * u.z + bb * v.z + w * vz;
+            float tu = 0, tv = 0, density = 0;
+            if (textured)
             {
-                x++;
-                ptmp = rotate(x - xc, y0 - 1 - yc, cosa, -sina);
-                xtmp = ptmp.x(); ytmp = ptmp.y();
+                // 球面上一个像素覆盖的面积约为1/(radius²·w)，经纬度展开后再除以2π²·sinθ
+                sphereUV(xn, yn, zn, tu, tv);
+                float area = radius * radius * mymax(w, 1e-3f) * 2 * PI * PI
+                        * mymax(float(sqrt(mymax(1 - zn * zn, 0.0f))), 1e-3f);
+                density = -0.5f * log2(area);
             }
-            if (y0 - 1 >= 0 && !mask[y0 - 1][x] && (xtmp * xtmp / (ra * ra) + ytmp * ytmp / (rb * rb)) < 1)
-                s.push_back(QPointF(x, y0 - 1));
+            g.append(x, y, d, xn, yn, zn, tu, tv, density);
         }
     }
 }
 
-bool in4region(int x1, int y1, int x2, int y2)
+// 球面网格的三角形遍历：单位球网格经模型-视图-投影变换，剔除背面，按近平面裁剪，
+// 再按扇形交给shader光栅化，clipRect之外的像素不处理。每个正面三角形先调用
+// shader.beginFace(顶点法向量之和)，拆出的每个三角形再调用shader.setTriangle。
+// intensities非空时为各网格顶点上三个通道的亮度，随其他属性一起插值
+template<class Shader>
+void sphereTriangles(Shader &shader, const SphereMesh &mesh, const Camera &camera, QLineF line,
+                     const float *intensities, const QRect &clipRect)
 {
-    if (abs(x1 - x2) <= 1 && abs(y1 - y2) <= 1)
-        return true;
-    else
-        return false;
-}
-// bezier曲线生成
-void bezier(QPainter *painter, QVector<QPointF> *points)
-{
-    int size = points->size();
-    painter->drawPoint(points->at(0));
-    painter->drawPoint(points->at(size - 1));
-    bool flag = true;
-    for (int i = 0; i < size - 1; i++)
-    {
-        int x1 = points->at(i).x(), y1 = points->at(i).y();
-        int x2 = points->at(i + 1).x(), y2 = points->at(i + 1).y();
-        if (!in4region(x1, y1, x2, y2))
-        {
-            flag = false;
-            break;
-        }
-    }
-    if (flag)
-    {
-        for (int i = 1; i < size - 1; i++)
-            painter->drawPoint(points->at(i));
+    int cx = line.x1(), cy = line.y1();
+    double radius = sphereRadius(line, camera.height);
+    // 半径为0时模型-视图矩阵奇异，不能求逆
+    if (radius <= 0)
         return;
-    }
 
-    QVector<QPointF> tmp1;
-    QVector<QPointF> tmp2;
-    QVector<QPointF> points1;
-    QVector<QPointF> points2;
-    points1.append(points->at(0));
-    points2.append(points->at(size - 1));
-
-    for (int i = 0; i < size; i++)
+    // 模型-视图矩阵：单位球按半径缩放，按观察方向旋转，再平移到点击处
+    QMatrix4x4 modelView;
+    modelView.translate(cx, cy, 0);
+    modelView *= camera.view;
+    modelView.scale(radius);
+    QVector<float> clip, screen;
+    transformVertices(mesh, camera.projection * modelView, camera, clip, screen);
+    int count = mesh.xs.size();
+    const float *clipx = clip.constData(), *clipy = clipx + count, *clipz = clipy + count, *clipw = clipz + count;
+    const float *sx = screen.constData(), *sy = sx + count, *sz = sy + count;
+
+    // 视点在单位球自身坐标中的齐次坐标；平行投影时是无穷远处的观察方向
+    QMatrix4x4 inv = modelView.inverted();
+    float eye[4] = { 0, 0, 1, 0 };
+    if (camera.perspective)
     {
-        tmp2.append(points->at(i));
-        if ((i + 1) % 3 == 0 && (i + 1) < size)
-            tmp2.append((points->at(i) + points->at(i + 1)) / 2);
+        eye[0] = camera.width / 2.0f;
+        eye[1] = camera.height / 2.0f;
+        eye[2] = camera.distance;
+        eye[3] = 1;
     }
-    size = tmp2.size();
-    for (int i = 0; i < size - 1; i++)
+    QVector3D E(inv(0, 0) * eye[0] + inv(0, 1) * eye[1] + inv(0, 2) * eye[2] + inv(0, 3) * eye[3],
+                inv(1, 0) * eye[0] + inv(1, 1) * eye[1] + inv(1, 2) * eye[2] + inv(1, 3) * eye[3],
+                inv(2, 0) * eye[0] + inv(2, 1) * eye[1] + inv(2, 2) * eye[2] + inv(2, 3) * eye[3]);
+    float Ew = inv(3, 0) * eye[0] + inv(3, 1) * eye[1] + inv(3, 2) * eye[2] + inv(3, 3) * eye[3];
+
+    const int *index = mesh.indices.constData();
+    for (int i = 0; i < mesh.triangleCount(); i++, index += 3)
     {
-        for (int j = 0; j < tmp2.size() - 1; j++)
+        const QVector3D &a = mesh.vertices.at(index[0]);
+        const QVector3D &b = mesh.vertices.at(index[1]);
+        const QVector3D &c = mesh.vertices.at(index[2]);
+
+        // 背面剔除：面法向量（叉积，按顶点法向量之和定向朝外）背向视点的三角形
+        // 在光栅化之前就丢弃。球面是凸的，剩下的正面三角形恰好不重叠地覆盖轮廓
+        QVector3D face = QVector3D::crossProduct(b - a, c - a);
+        double facing = QVector3D::dotProduct(face, E - a * Ew);
+        if (QVector3D::dotProduct(face, a + b + c) < 0)
+            facing = -facing;
+        if (facing <= 0)
+            continue;
+        shader.beginFace(a + b + c);
+
+        // 跨过近平面的三角形裁剪成凸多边形，再按扇形拆开。
+        // attr为各顶点除以w的法向量、深度、除以w的纹理坐标、1/w和除以w的三个通道的亮度，
+        // 即着色器插值的属性
+        QPointF q[4];
+        float attr[4][10];
+        int n = 3;
+        if (clipz[index[0]] + clipw[index[0]] >= 0 && clipz[index[1]] + clipw[index[1]] >= 0
+                && clipz[index[2]] + clipw[index[2]] >= 0)
         {
-            QPointF tmpP0 = tmp2.at(j);
-            QPointF tmpP1 = tmp2.at(j + 1);
-            tmp1.append((tmpP0 + tmpP1) / 2);
+            for (int k = 0; k < 3; k++)
+            {
+                int j = index[k];
+                q[k] = QPointF(sx[j], sy[j]);
+                attr[k][0] = mesh.xs[j] / clipw[j];
+                attr[k][1] = mesh.ys[j] / clipw[j];
+                attr[k][2] = mesh.zs[j] / clipw[j];
+                attr[k][3] = sz[j];
+                attr[k][4] = mesh.us[j] / clipw[j];
+                attr[k][5] = mesh.vs[j] / clipw[j];
+                attr[k][6] = 1 / clipw[j];
+                for (int c = 0; c < 3; c++)
+                    attr[k][7 + c] = intensities ? intensities[j * 3 + c] / clipw[j] : 0;
+            }
         }
-        tmp2.clear();
-        for (int j = 0; j < tmp1.size(); j++)
+        else
         {
-            tmp2.append(tmp1.at(j));
+            ClipVertex in[3], out[4];
+            for (int k = 0; k < 3; k++)
+            {
+                int j = index[k];
+                in[k].x = clipx[j]; in[k].y = clipy[j]; in[k].z = clipz[j]; in[k].w = clipw[j];
+                in[k].n = mesh.vertices.at(j);
+                in[k].u = mesh.us[j];
+                in[k].v = mesh.vs[j];
+                for (int c = 0; c < 3; c++)
+                    in[k].I[c] = intensities ? intensities[j * 3 + c] : 0;
+            }
+            n = clipNear(in, out);
+            for (int k = 0; k < n; k++)
+            {
+                q[k] = QPointF((out[k].x / out[k].w + 1) * camera.width / 2,
+                               (out[k].y / out[k].w + 1) * camera.height / 2);
+                attr[k][0] = out[k].n.x() / out[k].w;
+                attr[k][1] = out[k].n.y() / out[k].w;
+                attr[k][2] = out[k].n.z() / out[k].w;
+                attr[k][3] = out[k].z / out[k].w;
+                attr[k][4] = out[k].u / out[k].w;
+                attr[k][5] = out[k].v / out[k].w;
+                attr[k][6] = 1 / out[k].w;
+                for (int c = 0; c < 3; c++)
+                    attr[k][7 + c] = out[k].I[c] / out[k].w;
+            }
         }
-        tmp1.clear();
-        points1.append(tmp2.at(0));
-        points2.append(tmp2.at(tmp2.size() - 1));
-
-    }
-    bezier(painter, &points1);
-    bezier(painter, &points2);
-}
-
-//B-样条
-void bspline(QPainter *painter, QVector<QPointF> *points)
-{
-    int n = points->size() - 1;
-    int d = 4;
-    int* t = new int[n + d + 2];
-    for (int i = 0; i < n + d + 2; i++)
-        t[i] = i;
-
-    int xt, yt;
-    float step = 0.1 / sqrt((points->at(n).x() - points->at(0).x()) * (points->at(n).x() - points->at(0).x()) +
-                   (points->at(n).y() - points->at(0).y()) * (points->at(n).y() - points->at(0).y()));
-    for (int k = 0; k < n - 2; k += 1)
-    {
-        xt = 0; yt = 0;
-        for (float i = 0; i <= 1; i += step)
+        for (int k = 1; k + 1 < n; k++)
         {
-            int x1 = points->at(k).x(), y1 = points->at(k).y();
-            int x2 = points->at(k + 1).x(), y2 = points->at(k + 1).y();
-            int x3 = points->at(k + 2).x(), y3 = points->at(k + 2).y();
-            int x4 = points->at(k + 3).x(), y4 = points->at(k + 3).y();
-            xt = ((-x1 + 3 * x2 - 3 * x3 + x4) * i * i * i +
-                    (x1 * 3 - 6 * x2 + 3 * x3) * i * i +
-                    (-x1 * 3 + 3 * x3) * i +
-                    (x1 + 4 * x2 + x3)) / 6;
-            yt = ((-y1 + 3 * y2 - 3 * y3 + y4) * i * i * i +
-                    (y1 * 3 - 6 * y2 + 3 * y3) * i * i +
-                    (-y1 * 3 + 3 * y3) * i +
-                    (y1 + 4 * y2 + y3)) / 6;
-            painter->drawPoint(xt, yt);
+            shader.setTriangle(attr[0], attr[k], attr[k + 1], q[0], q[k], q[k + 1]);
+            fillTriangle(shader, q[0], q[k], q[k + 1], clipRect);
         }
     }
-
-    delete[] t;
-    t = NULL;
 }
-//koch曲线
-void Koch(QPainter *painter, QLineF line, int n)
+
+//真实感图形球体的几何阶段：把球面光栅化进几何缓冲。mode为1时不经过三角网格，
+//直接逐像素求球面法向量。几何缓冲覆盖整个球，与当前的裁剪区无关
+void sphereGeometry(GBuffer &g, const SphereMesh &mesh, const Camera &camera, QLineF line,
+                    float vx, float vy, float vz, bool textured, int mode)
 {
-    int x1 = line.x1(), y1 = line.y1();
-    int x2 = line.x2(), y2 = line.y2();
-    if (n == 0)
+    int cx = line.x1(), cy = line.y1();
+    double radius = sphereRadius(line, camera.height);
+    QRect canvas(0, 0, camera.width, camera.height);
+    g.clear();
+
+    if (mode == 1)
     {
-        drawLine(painter, line);
+        sphereDisc(g, camera, cx, cy, radius, vx, vy, vz, textured, canvas);
         return;
     }
-    else
-    {
-        int dx = (x2 - x1) / 3, dy = (y2 - y1) / 3;
-        int x11 = x1 + dx, y11 = y1 + dy;
-        int x12 = x2 - dx, y12 = y2 - dy;
-        int x13 = x11 + (dx - sqrt(3) * dy) / 2;
-        int y13 = y11 + (dx * sqrt(3) + dy) / 3;
 
-        QLineF tmp;
-        QPoint tmpp1, tmpp2;
-        tmpp1.setX(x11); tmpp1.setY(y11);
-        tmp.setP1(line.p1()); tmp.setP2(tmpp1);
-        Koch(painter, tmp, n - 1);
-        tmpp2.setX(x13); tmpp2.setY(y13);
-        tmp.setP1(tmpp1); tmp.setP2(tmpp2);
-        Koch(painter, tmp, n - 1);
-        tmpp1.setX(x12); tmpp1.setY(y12);
-        tmp.setP1(tmpp2); tmp.setP2(tmpp1);
-        Koch(painter, tmp, n - 1);
-        tmp.setP1(tmpp1); tmp.setP2(line.p2());
-        Koch(painter, tmp, n - 1);
-    }
+    SphereGeometry shader;
+    shader.g = &g;
+    shader.textured = textured;
+    sphereTriangles(shader, mesh, camera, line, 0, canvas);
 }
 
-//蕨类植物
-void ferns(QPainter *painter, QLineF line)
+// 场景中的光源换到球体自身的坐标中：方向光取反成指向光源的单位向量；点光源的画布坐标
+// 减去球心后按观察方向转回球面坐标，再以半径为单位。第一个为主光源，沿用原来的模型，
+// 背光一侧的负余弦让背光面更暗，再由归一化拉开到整个亮度范围；其余光源背光的一侧不计亮度，
+// 否则会抵消别的光源照亮的部分
+QVector<ShadeLight> sphereShadeLights(const QVector<Light> &lights, const Camera &camera, QLineF line,
+                                      float vx, float vy, float vz)
 {
-    int x1 = line.x1(), y1 = line.y1();
-
-    painter->setPen("green");
-    float x0 = 0, y0 = 0;
-    for (int t = 0; t < 15550; t++)
+    int cx = line.x1(), cy = line.y1();
+    double radius = sphereRadius(line, camera.height);
+    radius = radius > 0 ? radius : 1;
+    const QMatrix4x4 &m = camera.view;
+    QVector<ShadeLight> result(lights.size());
+    for (int k = 0; k < lights.size(); k++)
     {
-        float prob = rand() / (RAND_MAX - 0.1);
-
-        float x = x0, y = y0;
-        if (prob <= 0.01)
-        {
-            x0 = 0;
-            y0 = 0.16 * y;
-        }
-        else if (prob <= 0.08)
-        {
-            x0 = (-0.15 * x + 0.28 * y);
-            y0 = (0.26 * x + 0.24 * y + 0.44);
-        }
-        else if (prob <= 0.15)
+        const Light &light = lights.at(k);
+        ShadeLight &l = result[k];
+        l.point = light.point;
+        l.clamp = k > 0;
+        QVector3D d;
+        if (light.point)
         {
-            x0 =  (0.2 * x - 0.26 * y);
-            y0 =  (0.23 * x + 0.22 * y + 1.6);
+            QVector3D o = light.position - QVector3D(cx, cy, 0);
+            d = QVector3D(m(0, 0) * o.x() + m(1, 0) * o.y() + m(2, 0) * o.z(),
+                          m(0, 1) * o.x() + m(1, 1) * o.y() + m(2, 1) * o.z(),
+                          m(0, 2) * o.x() + m(1, 2) * o.y() + m(2, 2) * o.z()) / radius;
+            l.x = d.x(); l.y = d.y(); l.z = d.z();
+            d.normalize();
         }
         else
         {
-            x0 = (0.85 * x + 0.04 * y);
-            y0 = (-0.04 * x + 0.85 * y + 1.6);
+            d = -light.position.normalized();
+            l.x = d.x(); l.y = d.y(); l.z = d.z();
         }
-        painter->drawPoint(x1 + x0 * 30, y1 + y0 * 30);
+        QVector3D h = (d + QVector3D(vx, vy, vz)).normalized();
+        l.hx = h.x(); l.hy = h.y(); l.hz = h.z();
+        float scale = light.intensity / 255;
+        l.r = light.color.red() * scale;
+        l.g = light.color.green() * scale;
+        l.b = light.color.blue() * scale;
     }
+    return result;
 }
 
-
-double getVectorAngle(double xn1, double yn1, double zn1, double xn2,
-                      double yn2, double zn2)
+// 球体的光照参数：光源已换到球面自身的坐标中，观察方向(vx, vy, vz)也是。
+// 环境光强度乘材质的环境光反射系数，光源的强度在各光源的颜色里。
+// 亮度按所有光源下整个球面上的最大、最小值归一化。lights要在params用完之前一直有效
+ShadeParams sphereShadeParams(const Material &material, QRgb rgb, const QVector<ShadeLight> &lights,
+                              float ambientLight, float vx, float vy, float vz)
 {
-    return (xn1 * xn2 + yn1 * yn2 + zn1 * zn2) / (
-                sqrt(xn1 * xn1 + yn1 * yn1 + zn1 * zn1) *
-                sqrt(xn2 * xn2 + yn2 * yn2 + zn2 * zn2));
+    ShadeParams params;
+    params.lights = lights.constData();
+    params.lightCount = lights.size();
+    params.vx = vx; params.vy = vy; params.vz = vz;
+    params.ambient = ambientLight * material.ka;
+    params.diffuse = material.kd;
+    params.specular = material.ks;
+    params.shininess = material.shininess;
+    params.r = qRed(rgb);
+    params.g = qGreen(rgb);
+    params.b = qBlue(rgb);
+    params.table = 0;
+    phongRange(params);
+    return params;
 }
 
-void drawLine(QPainter* painter, bool** mask, QLineF line)
+//真实感图形球体的光照阶段：对几何缓冲中的像素先做深度测试，被前面的三维图元挡住的
+//不计算光照；可见的逐像素计算Phong光照，texture非空时颜色再乘上贴图的纹素，
+//smooth为真时纹素双线性插值，否则取最近的。
+//光源和各项系数对所有像素都不变，预先算好交给向量化的着色内核，逐个光源累加；
+//table非空时改为查tableSize×tableSize的光照表。
+//每批像素先测试深度并把可见像素的法向量收集到连续数组，着色后再写出
+void sphereLighting(RasterTarget *target, const GBuffer &g, ShadeParams params,
+                    const Texture *texture, bool smooth,
+                    PhongTable *table, int tableSize)
 {
-    int x1, y1, x2, y2;
-    x1 = line.x1(); y1 = line.y1();
-    x2 = line.x2(); y2 = line.y2();
-    int x = x1, y = y1;
-    int dx = abs(x2 - x1), dy = abs(y2 - y1);
-    mask[y][x] = 1;
-    mask[y2][x2] = 1;
-    if (dx == 0 && y < y2)
+    ShadeFunction shade = shadePixels;
+    if (table)
     {
-        while (y < y2)
-        {
-            mask[y][x] = 1;
-            y++;
-        }
-        return;
+        table->update(params, tableSize);
+        params.table = table;
+        shade = shadePixelsTable;
     }
-    if (dx == 0 && y > y2)
-    {
-        while (y > y2)
-        {
-            mask[y][x] = 1;
-            y--;
-        }
-        return;
-    }
-    if (dy == 0 && x < x2)
-    {
-        while (x < x2)
-        {
-            mask[y][x] = 1;
-            x++;
-        }
-        return;
-    }
-    if (dy == 0 && x > x2)
+
+    const QRect &clip = target->clipRect();
+    const int batch = 256;
+    int visible[batch];
+    float nx[batch], ny[batch], nz[batch];
+    QRgb texels[batch], colors[batch];
+    for (int first = 0; first < g.size(); first += batch)
     {
-        while (x > x2)
+        int last = mymin(first + batch, g.size()), count = 0;
+        for (int i = first; i < last; i++)
         {
-            mask[y][x] = 1;
-            x--;
+            int x = g.xs[i], y = g.ys[i];
+            if (!clip.contains(x, y))
+                continue;
+            float *depth = target->depthLine(y) + x;
+            if (g.depth[i] >= *depth)
+                continue;
+            *depth = g.depth[i];
+            nx[count] = g.nx[i];
+            ny[count] = g.ny[i];
+            nz[count] = g.nz[i];
+            if (texture)
+                texels[count] = texture->sample(g.us[i], g.vs[i], g.densities[i], smooth);
+            visible[count++] = i;
         }
-        return;
+
+        shade(params, nx, ny, nz, texture ? texels : 0, count, colors);
+        for (int k = 0; k < count; k++)
+            target->setPixel(g.xs[visible[k]], g.ys[visible[k]], colors[k]);
     }
-    if (dx == dy && y < y2)
+}
+
+// Gouraud和平面着色的三角形着色器：不经过几何缓冲，逐像素做深度测试后直接写出。
+// Gouraud时顶点各通道的亮度与纹理坐标一样除以w插值；平面着色时整个三角形取面法向量处的亮度
+struct SphereShaded
+{
+    RasterTarget *target;
+    ShadeParams params;
+    const Texture *texture;
+    bool smooth;
+    bool flat;
+    float scale[3]; // 物体颜色除以255，见shadeColor
+    float faceI[3]; // 平面着色时当前三角形的亮度
+    float a0[10], a1[10], a2[10]; // 同SphereGeometry，只用深度及其后的分量
+    float density;
+
+    void beginFace(const QVector3D &n)
     {
-        while (x < x2)
-        {
-            mask[y][x] = 1;
-            x++; y++;
-        }
-        while (x > x2)
-        {
-            mask[y][x] = 1;
-            x--; y++;
-        }
-        return;
+        if (!flat)
+            return;
+        float len = n.length();
+        float x = n.x() / len, y = n.y() / len, z = n.z() / len;
+        shadeIntensities(params, &x, &y, &z, 1, faceI);
     }
-    if (dx == dy && y > y2)
+
+    void setTriangle(const float *v0, const float *v1, const float *v2,
+                     const QPointF &q0, const QPointF &q1, const QPointF &q2)
     {
-        while (x < x2)
-        {
-            mask[y][x] = 1;
-            x++; y--;
-        }
-        while (x > x2)
+        for (int i = 3; i < 10; i++)
         {
-            mask[y][x] = 1;
-            x--; y--;
+            a0[i] = v0[i];
+            a1[i] = v1[i] - v0[i];
+            a2[i] = v2[i] - v0[i];
         }
-        return;
+        density = texture ? triangleDensity(v0, v1, v2, q0, q1, q2) : 0;
     }
 
-    if (dy < dx)
+    void span(int y, int x0, int x1, const Barycentric &b)
     {
-        int p = 2 * dy - dx;
-        int dy2 = 2 * dy, dymdx2 = 2 * (dy - dx);
-        if (x < x2)
-        while (x < x2)
+        float s[10], d[10];
+        for (int i = 3; i < 10; i++)
         {
-            x++;
-            if (p < 0)
-            {
-                p += dy2;
-            }
-            else
-            {
-                if ((y2 - y1) < 0)
-                    y--;
-                else
-                    y++;
-                p += dymdx2;
-            }
-            mask[y][x] = 1;
-
+            s[i] = a0[i] + b.l1 * a1[i] + b.l2 * a2[i];
+            d[i] = b.dl1 * a1[i] + b.dl2 * a2[i];
         }
-        else
-        while (x > x2)
+        float *depth = target->depthLine(y);
+        QRgb *line = target->scanLine(y);
+        for (int x = x0; x <= x1; x++)
         {
-            x--;
-            if (p < 0)
+            if (s[3] < depth[x])
             {
-                p += dy2;
+                depth[x] = s[3];
+                float w = 1 / s[6];
+                float I[3] = { s[7] * w, s[8] * w, s[9] * w };
+                QRgb texel = 0;
+                if (texture)
+                    texel = texture->sample(s[4] * w, s[5] * w, density, smooth);
+                line[x] = shadeColor(params, flat ? faceI : I, texture ? &texel : 0, scale);
             }
-            else
-            {
-                if ((y2 - y1) < 0)
-                    y--;
-                else
-                    y++;
-                p += dymdx2;
-            }
-            mask[y][x] = 1;
+            for (int i = 3; i < 10; i++)
+                s[i] += d[i];
         }
-        return;
     }
-    else
+};
+
+//真实感图形球体的Gouraud和平面着色：亮度只在网格顶点上（平面着色时在每个三角形上）计算，
+//光栅化时直接插值写出，不建几何缓冲，也只处理裁剪区内的像素。只用于三角网格模式
+void sphereShading(RasterTarget *target, const SphereMesh &mesh, const Camera &camera, QLineF line,
+                   const ShadeParams &params, const Texture *texture, bool smooth, bool flat)
+{
+    QVector<float> intensities;
+    if (!flat)
     {
-        int p = 2 * dx - dy;
-        int dy2 = 2 * dx, dymdx2 = 2 * (dx - dy);
-        if (y < y2)
-            while (y < y2)
-            {
-                y++;
-                if (p < 0)
-                {
-                    p += dy2;
-                }
-                else
-                {
-                    if ((x2 - x1) < 0)
-                        x--;
-                    else
-                        x++;
-                    p += dymdx2;
-                }
-                mask[y][x] = 1;
-        }
-        else
-        {
-            while (y > y2)
-            {
-                y--;
-                if (p < 0)
-                {
-                    p += dy2;
-                }
-                else
-                {
-                    if ((x2 - x1) < 0)
-                        x--;
-                    else
-                        x++;
-                    p += dymdx2;
-                }
-                mask[y][x] = 1;
-            }
-        }
+        intensities.resize(mesh.xs.size() * 3);
+        shadeIntensities(params, mesh.xs.constData(), mesh.ys.constData(), mesh.zs.constData(),
+                         mesh.xs.size(), intensities.data());
     }
+
+    SphereShaded shader;
+    shader.target = target;
+    shader.params = params;
+    shader.texture = texture;
+    shader.smooth = smooth;
+    shader.flat = flat;
+    shader.scale[0] = params.r / 255;
+    shader.scale[1] = params.g / 255;
+    shader.scale[2] = params.b / 255;
+    shader.faceI[0] = shader.faceI[1] = shader.faceI[2] = 0;
+    sphereTriangles(shader, mesh, camera, line, flat ? 0 : intensities.constData(), target->clipRect());
 }
-//三角形填充
-void fill_triangle(QPainter *painter, QPointF p1, QPointF p2, QPointF p3, bool** mask,
-                     int height, int width)
+
+// 第level级细分的单位球面网格，首次使用时生成，之后所有球体图元共用
+const SphereMesh &Painter::sphereMesh(int level)
 {
-    for (int i = 0; i < height; i++)
+    QHash<int, SphereMesh>::iterator it = m_meshes.find(level);
+    if (it == m_meshes.end())
     {
-        memset(mask[i], 0, sizeof(bool) * width);
+        it = m_meshes.insert(level, SphereMesh());
+        it->build(level);
     }
+    return *it;
+}
 
-    double x1 = p1.x(), y1 = p1.y();
-    double x2 = p2.x(), y2 = p2.y();
-    double x3 = p3.x(), y3 = p3.y();
+// 按球在屏幕上的半径选细分级别，使三角形边长约为40/quality个像素：
+// 小球只需几十个三角形，大球的轮廓和高光仍然平滑
+int Painter::sphereLevel(const QLineF &line) const
+{
+    QRectF rect = sphereRect(line);
+    double radius = mymax(rect.width(), rect.height()) / 2;
+    int level = int(ceil(PI * radius * m_quality / 40));
+    return qBound(3, level, 64);
+}
 
-    drawLine(painter, mask, QLineF(p1, p2));
-    drawLine(painter, mask, QLineF(p2, p3));
-    drawLine(painter, mask, QLineF(p3, p1));
+// 球体图元投影到屏幕上的范围
+QRectF Painter::sphereRect(const QLineF &line) const
+{
+    return sphereBounds(camera(), line.x1(), line.y1(), sphereRadius(line, height()));
+}
 
+// 观察方向决定的旋转：三行依次是屏幕x轴u、y轴v和指向观察者的方向n
+QMatrix4x4 Painter::viewMatrix() const
+{
+    float len = sqrt(m_vThetax * m_vThetax + m_vThetay * m_vThetay + m_vThetaz * m_vThetaz);
+    float nx = m_vThetax / len, ny = m_vThetay / len, nz = m_vThetaz / len;
+    Point3D u, v;
+    viewBasis(nx, ny, nz, u, v);
+    return QMatrix4x4(u.x, u.y, u.z, 0,
+                      v.x, v.y, v.z, 0,
+                      nx, ny, nz, 0,
+                      0, 0, 0, 1);
+}
 
-    double xmax = mymax(mymax(x1, x2), x3), xmin = mymin(mymin(x1, x2), x3);
-    double ymax = mymax(mymax(y1, y2), y3), ymin = mymin(mymin(y1, y2), y3);
+// 画布坐标到裁剪坐标。视点在画布中心正前方，距离使竖直视角恰为fov，
+// 所以画布平面上的点不论哪种投影都落在原来的像素上
+QMatrix4x4 Painter::projectionMatrix() const
+{
+    QMatrix4x4 m;
+    double w = width(), h = height();
+    if (w <= 0 || h <= 0)
+        return m;
+    double distance = h / 2 / tan(m_fov * PI / 360);
+    if (m_bPerspective)
+        m.perspective(m_fov, w / h, 1, distance + h);
+    else
+        m.ortho(-w / 2, w / 2, -h / 2, h / 2, 1, distance + h);
+    m.translate(-w / 2, -h / 2, -distance);
+    return m;
+}
 
-    for (int i = ymin - 1; i <= ymax + 1; i++)
+Camera Painter::camera() const
+{
+    Camera c;
+    c.view = viewMatrix();
+    c.projection = projectionMatrix();
+    c.perspective = m_bPerspective;
+    c.distance = height() / 2 / tan(m_fov * PI / 360);
+    c.width = width();
+    c.height = height();
+    return c;
+}
+
+void Painter::setPerspective(bool perspective)
+{
+    if (m_bPerspective != perspective)
     {
-        int xb = xmin, xe = xmax;
-        int mn0 = 0;
-        for (int j = xmin - 1; j <= xmax + 1; j++)
-        {
-            if (mask[i][j] && mn0 == 0)
-            {
-                mn0++;
-                xb = j;
-            }
-            else if (mask[i][j])
-            {
-                mn0++;
-                xe = j;
-            }
-        }
-        if (mn0 >= 2)
-        {
-            for (int j = xb - 1; j <= xe + 1; j++)
-                painter->drawPoint(j, i);
-        }
+        m_bPerspective = perspective;
+        invalidateGeometry();
+        emit cameraChanged();
     }
-
 }
 
-
-
-Point3D getN(double vx, double vy, double vz, double nx, double ny, double nz)
+// 视角限制在10~120度：视点到画布的距离总大于球的最大半径（画布高度的1/4）
+void Painter::setFov(int fov)
 {
-    double tmp = sqrt((vy * nz - vz * ny) * (vy * nz - vz * ny) +
-                      (nx * vz - vx * nz) * (vz * nx - vx * nz) +
-                      (vx * ny - vy * nx) * (vx * ny - nx * vy));
-    Point3D p;
-    p.x = (vy * nz - vz * ny) / tmp;
-    p.y = (nx * vz - vx * nz) / tmp;
-    p.z = (vx * ny - vy * nx) / tmp;
-    return p;
+    fov = qBound(10, fov, 120);
+    if (m_fov != fov)
+    {
+        m_fov = fov;
+        invalidateGeometry();
+        emit cameraChanged();
+    }
 }
 
-QPointF projection_v2(Point3D p, double nx, double ny, double nz, int bx, int by)
+void Painter::geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry)
 {
-    double ux = 0, uy = 1.0, uz = 0;
-    if (ux == nx && ny == uy && nz == uz)
-        ux++;
-    double vx, vy, vz;
-    Point3D up, vp;
-    if (fabs(ux * nx + uy * ny + uz * nz) != 0)
+    QQuickPaintedItem::geometryChanged(newGeometry, oldGeometry);
+    if (newGeometry.size() != oldGeometry.size())
     {
-        up = getN(ux, uy, uz, nx, ny, nz);
-        ux = up.x; uy = up.y; uz = up.z;
+        m_geometryStamp++;
+        emit cameraChanged();
     }
-    vp = getN(ux, uy, uz, nx, ny, nz);
-    vx = vp.x; vy = vp.y; vz = vp.z;
-    QPointF rp;
-    rp.setX(ux * (p.x) + uy * (p.y) + uz * (p.z) + bx);
-    rp.setY(vx * (p.x)+ vy * (p.y) + vz * (p.z) + by);
-    return rp;
 }
 
+void Painter::setQuality(int quality)
+{
+    quality = qBound(1, quality, 10);
+    if (m_quality != quality)
+    {
+        m_quality = quality;
+        invalidateGeometry();
+    }
+}
 
-Point3DN yminp(Point3DN p1, Point3DN p2, Point3DN p3)
+void Painter::setLightTable(int size)
 {
-    double ymin = mymin(mymin(p1.py, p2.py), p3.py);
-    if (p1.py == ymin)
-        return p1;
-    else if (p2.py == ymin)
-        return p2;
-    else
-        return p3;
+    size = size <= 0 ? 0 : qBound(16, size, 1024);
+    if (m_lightTable != size)
+    {
+        m_lightTable = size;
+        invalidate3D();
+    }
 }
-Point3DN ymaxp(Point3DN p1, Point3DN p2, Point3DN p3)
+
+// 贴图文件的路径或url，为空或读取失败时用默认的棋盘格
+void Painter::setTexture(const QString &source)
 {
-    double ymax = mymax(mymax(p1.py, p2.py), p3.py);
-    if (p1.py == ymax)
-        return p1;
-    else if (p2.py == ymax)
-        return p2;
-    else
-        return p3;
+    if (m_textureSource == source)
+        return;
+    m_textureSource = source;
+    QImage image;
+    if (!source.isEmpty())
+    {
+        QUrl url(source);
+        QString path = source;
+        if (url.isLocalFile())
+            path = url.toLocalFile();
+        else if (url.scheme() == "qrc")
+            path = ":" + url.path();
+        if (!image.load(path))
+            qWarning() << "无法读取贴图" << source;
+    }
+    m_texture = Texture(image.isNull() ? Texture::checkerboard(16, 8, 32) : image);
+    invalidate3D();
 }
 
-Point3DN ymidp(Point3DN p1, Point3DN p2, Point3DN p3)
+void Painter::setSmoothTexture(bool smooth)
 {
-    double ymin = mymin(mymin(p1.py, p2.py), p3.py);
-    double ymax = mymax(mymax(p1.py, p2.py), p3.py);
-    if (p1.py != ymin && p1.py != ymax)
-        return p1;
-    else if (p2.py != ymin && p2.py != ymax)
-        return p2;
-    else
-        return p3;
+    if (m_bSmoothTexture != smooth)
+    {
+        m_bSmoothTexture = smooth;
+        invalidate3D();
+    }
 }
 
-//真实感图形球体生成
-void sphere(QPainter *painter, QLineF line, QRgb rgb,
-            float lx, float ly, float lz,
-            float vx, float vy, float vz)
+void Painter::setShadingMode(int mode)
 {
-    QPaintDevice* qpd =  painter->device();
-    int height = qpd->height(), width = qpd->width();
-    QVector<TriSurfaceN> surfaceList;
-    Point3DN p3d[101][101];
-    int countx, county;
-    double x1 = line.x1(), y1 = line.y1(), bz = 0;
-    double bx = 0, by = 0;
-    int x2 = line.x2(), y2 = line.y2();
-    double radius = sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
-    radius = (radius > height / 4) ? height /4 : radius;
-    float Ia = 228, I0 = 228;
-    double ka = 0.5, kd = 0.8, ks = 0.3;
-    int n = 2;
+    mode = qBound(0, mode, 2);
+    if (m_shadingMode != mode)
+    {
+        m_shadingMode = mode;
+        invalidate3D();
+    }
+}
 
-    qDebug() << bx << by << radius;
+void Painter::setLightColor(const QColor &color)
+{
+    if (m_lightColor != color)
+    {
+        m_lightColor = color;
+        invalidate3D();
+    }
+}
 
-    int i = 0, j;
-    float Imax = 0, Imin = 999999;
-    for (double u = -PI / 2; u < PI * 3 / 2; u += PI / 32)
+void Painter::setLightIntensity(int intensity)
+{
+    intensity = qBound(0, intensity, 1000);
+    if (m_lightIntensity != intensity)
     {
-        j = 0;
-        for (double v = 0; v < 2 * PI; v += PI / 32)
-        {
-            p3d[i][j].x = bx + radius * cos(u) * cos(v);
-            p3d[i][j].y = by + radius * cos(u) * sin(v);
-            p3d[i][j].z = bz + radius * sin(u);
-            p3d[i][j].xn = p3d[i][j].x / radius;
-            p3d[i][j].yn = p3d[i][j].y / radius;
-            p3d[i][j].zn = p3d[i][j].z / radius;
-            float cosfi = getVectorAngle(p3d[i][j].xn, p3d[i][j].yn, p3d[i][j].zn, -lx, -ly, -lz);
-            float cosnh = getVectorAngle((-lx + vx)/2, (-ly + vy)/2, (-lz + vz)/2, p3d[i][j].xn,
-                                         p3d[i][j].yn, p3d[i][j].zn);
-            float I = Ia * ka + kd * I0 * cosfi + ks * I0 * pow(cosnh, n);
-            if (I < Imin)   Imin = I;
-            if (I > Imax)   Imax = I;
-            j++;
-        }
-        i++;
+        m_lightIntensity = intensity;
+        invalidate3D();
     }
-    countx = i;
-    county = j;
-
-    double ymax, ymin, ymid;
-    double xmin, xmax;
-    double nax, nay, naz, nbx, nby, nbz;
-    double dnpx, dnpy, dnpz;
-    double xa, xb;
-    double xn, yn, zn;
-
-    int nnn0 = 0;
-    for (i = 0; i < countx; i++)
+}
+
+void Painter::setAmbientLight(int intensity)
+{
+    intensity = qBound(0, intensity, 1000);
+    if (m_ambientLight != intensity)
     {
-        for (j = 0; j < county; j++)
-        {
-            TriSurfaceN surface1, surface2;
-            surface1.p1 = p3d[i][j];
-            surface1.p2 = p3d[(i + 1) % countx][(j + 1) % county];
-            surface1.p3 = p3d[(i + 1) % countx][j];
+        m_ambientLight = intensity;
+        invalidate3D();
+    }
+}
 
-            surface2.p1 = p3d[i][j];
-            surface2.p2 = p3d[i][(j + 1) % county];
-            surface2.p3 = p3d[(i + 1) % countx][(j + 1) % county];
+int Painter::addLight(bool point, qreal x, qreal y, qreal z, const QColor &color, qreal intensity)
+{
+    Light light = { point, QVector3D(x, y, z), color, qBound(0.0, intensity, 1000.0) };
+    m_lights.append(light);
+    invalidate3D();
+    return m_lights.size() - 1;
+}
 
-            surfaceList.append(surface1);
-            surfaceList.append(surface2);
-        }
-    }
-    qDebug() << surfaceList.size() << nnn0 << Imin << Imax;
-
-    Imin = (Imin < 1e-3) ? 0 : Imin;
-    QPointF ptmp[3];
-    bool** mask = new bool*[height];
-    for (i = 0; i < height; i++)
-        mask[i] = new bool[width];
-    for (i = 0; i < surfaceList.size(); i++)
-    {
-        TriSurfaceN surface = surfaceList.at(i);
-        Point3D p10, p20, p30;
-        p10.x = surface.p1.x; p10.y = surface.p1.y; p10.z = surface.p1.z;
-        p20.x = surface.p2.x; p20.y = surface.p2.y; p20.z = surface.p2.z;
-        p30.x = surface.p3.x; p30.y = surface.p3.y; p30.z = surface.p3.z;
-        ptmp[0] = projection_v2(p10, vx, vy, vz, x1, y1);
-        ptmp[1] = projection_v2(p20, vx, vy, vz, x1, y1);
-        ptmp[2] = projection_v2(p30, vx, vy, vz, x1, y1);
-        Point3DN p100, p200, p300, p1, p2, p3;
-        p100 = surface.p1; p200 = surface.p2; p300 = surface.p3;
-        p100.px = ptmp[0].x(); p100.py = ptmp[0].y();
-        p200.px = ptmp[1].x(); p200.py = ptmp[1].y();
-        p300.px = ptmp[2].x(); p300.py = ptmp[2].y();
-        p3 = yminp(p100, p200, p300);
-        p2 = ymidp(p100, p200, p300);
-        p1 = ymaxp(p100, p200, p300);
-
-        ymax = (p1.py);
-        ymid = (p2.py);
-        ymin = (p3.py);
-
-        for (j = 0; j < height; j++)
-            memset(mask[j], 0, sizeof(bool) * width);
-        drawLine(painter, mask, QLineF(ptmp[0], ptmp[1]));
-        drawLine(painter, mask, QLineF(ptmp[1], ptmp[2]));
-        drawLine(painter, mask, QLineF(ptmp[2], ptmp[0]));
-
-        xmin = mymin(mymin(ptmp[0].x(), ptmp[1].x()), ptmp[2].x());
-        xmax = mymax(mymax(ptmp[0].x(), ptmp[1].x()), ptmp[2].x());
-
-        double p23 = sqrt((p2.px - p3.px) * (p2.px - p3.px) + (p2.py - p3.py) * (p2.py - p3.py));
-        double p31 = sqrt((p3.px - p1.px) * (p3.px - p1.px) + (p3.py - p1.py) * (p3.py - p1.py));
-        double p12 = sqrt((p2.px - p1.px) * (p2.px - p1.px) + (p2.py - p1.py) * (p2.py - p1.py));
-
-        for (int y = ymin; y <= ymax; y++)
-        {
-            int mn0 = 0;
-            xa = xmin; xb = xmax;
-            for (int j = xmin; j <= xmax; j++)
-            {
-                if (mask[y][j] && mn0 == 0)
-                {
-                    xa = j;
-                    mn0++;
-                }
-                else if (mask[y][j])
-                {
-                    xb = j;
-                    mn0++;
-                }
-            }
+void Painter::removeLight(int index)
+{
+    if (index < 0 || index >= m_lights.size())
+        return;
+    m_lights.remove(index);
+    invalidate3D();
+}
 
-            if (mn0 >= 2)
-            {
-                if (xa != xb)
-                {
-                    if (y < ymid)
-                    {
-                        double p2a, p3a, p3b, p1b;
-                        p2a = sqrt((y - p2.py) * (y - p2.py) + (xa - p2.px) * (xa - p2.px));
-                        p3a = sqrt((y - p3.py) * (y - p3.py) + (xa - p3.px) * (xa - p3.px));
-                        p1b = sqrt((y - p1.py) * (y - p1.py) + (xb - p1.px) * (xb - p1.px));
-                        p3b = sqrt((y - p3.py) * (y - p3.py) + (xb - p3.px) * (xb - p3.px));
-                        if (p23 != 0)
-                        {
-                            nax = (p2a * p3.xn + p3a * p2.xn) / p23;
-                            nay = (p2a * p3.yn + p3a * p2.yn) / p23;
-                            naz = (p2a * p3.zn + p3a * p2.zn) / p23;
-                        }
-                        else
-                        {
-                            nax = p2.xn; nay = p2.yn; naz = p2.zn;
-                        }
-                        if (p31 != 0)
-                        {
-                            nbx = (p3b * p1.xn + p1b * p3.xn) / p31;
-                            nby = (p3b * p1.yn + p1b * p3.yn) / p31;
-                            nbz = (p3b * p1.zn + p1b * p3.zn) / p31;
-                        }
-                        else
-                        {
-                            nbx = p1.xn; nby = p1.yn; nbz = p1.zn;
-                        }
-                    }
-                    else
-                    {
-                        double p2a, p1a, p3b, p1b;
-                        p2a = sqrt((y - p2.py) * (y - p2.py) + (xa - p2.px) * (xa - p2.px));
-                        p1a = sqrt((y - p1.py) * (y - p1.py) + (xa - p1.px) * (xa - p1.px));
-                        p1b = sqrt((y - p1.py) * (y - p1.py) + (xb - p1.px) * (xb - p1.px));
-                        p3b = sqrt((y - p3.py) * (y - p3.py) + (xb - p3.px) * (xb - p3.px));
-                        if (p12 != 0)
-                        {
-                            nax = (p2a * p1.xn + p1a * p2.xn) / p12;
-                            nay = (p2a * p1.yn + p1a * p2.yn) / p12;
-                            naz = (p2a * p1.zn + p1a * p2.zn) / p12;
-                        }
-                        else
-                        {
-                            nax = p2.xn; nay = p2.yn; naz = p2.zn;
-                        }
-                        if (p31 != 0)
-                        {
-                            nbx = (p3b * p1.xn + p1b * p3.xn) / p31;
-                            nby = (p3b * p1.yn + p1b * p3.yn) / p31;
-                            nbz = (p3b * p1.zn + p1b * p3.zn) / p31;
-                        }
-                        else
-                        {
-                            nbx = p1.xn; nby = p1.yn; nbz = p1.zn;
-                        }
-                    }
-                    double len = sqrt(nax * nax + nay * nay + naz * naz);
-                    nax /= len; nay /= len; naz /= len;
-                    len = sqrt(nbx * nbx + nby * nby + nbz * nbz);
-                    nbx /= len; nby /= len; nbz /= len;
-                    dnpx = (nbx - nax) / (xb - xa);
-                    dnpy = (nby - nay) / (xb - xa);
-                    dnpz = (nbz - naz) / (xb - xa);
-                }
-                else
-                {
-                    nax = p3.xn; nay = p3.yn; naz = p3.zn;
-                    dnpx = dnpy = dnpz = 0;
-                }
-                xn = nax; yn = nay; zn = naz;
-                for (double j = xa; j <= xb; j++)
-                {
-                    if (getVectorAngle(xn, yn, zn, vx, vy, vz) < 0)
-                        continue;
-                    float cosfi = getVectorAngle(xn, yn, zn, -lx, -ly, -lz);
-                    float cosnh = getVectorAngle((-lx + vx)/2, (-ly + vy)/2, (-lz + vz)/2, xn, yn, zn);
-                    float I = Ia * ka + kd * I0 * cosfi + ks * I0 * pow(cosnh, n);
-                    I = (I - Imin) / (Imax - Imin);
-
-                    double rtmp = (qRed(rgb)) * I;
-                    rtmp = rtmp > 255 ? 255 : rtmp;
-                    rtmp = rtmp < 0 ? 0 : rtmp;
-                    double gtmp = (qGreen(rgb)) * I;
-                    gtmp = gtmp > 255 ? 255 : gtmp;
-                    gtmp = gtmp < 0 ? 0 : gtmp;
-                    double btmp = (qBlue(rgb)) * I;
-                    btmp = btmp > 255 ? 255 : btmp;
-                    btmp = btmp < 0 ? 0 : btmp;
-                    uchar r = rtmp;
-                    uchar g = gtmp;
-                    uchar b = btmp;
-                    painter->setPen(QColor(r, g, b));
-                    painter->drawPoint(j, y);
-                    xn += dnpx;
-                    yn += dnpy;
-                    zn += dnpz;
-                }
-            }
-        }
-    }
+void Painter::clearLights()
+{
+    if (m_lights.isEmpty())
+        return;
+    m_lights.clear();
+    invalidate3D();
+}
 
-    for (int i = 0; i < height; i++)
+void Painter::setSphereMode(int mode)
+{
+    mode = qBound(0, mode, 1);
+    if (m_sphereMode != mode)
     {
-        delete[] mask[i];
-        mask[i] = NULL;
+        m_sphereMode = mode;
+        invalidateGeometry();
     }
-    delete[] mask;
-    mask = NULL;
 }
 
-//纹理映射
-void sphere_texture(QPainter *painter, QLineF line, QRgb rgb,
-            float lx, float ly, float lz,
-            float vx, float vy, float vz)
+void Painter::paint(QPainter *painter)
 {
-    QPaintDevice* qpd =  painter->device();
-    int height = qpd->height(), width = qpd->width();
-    QVector<TriSurfaceN> surfaceList;
-    Point3DN p3d[101][101];
-    int countx, county;
-    double x1 = line.x1(), y1 = line.y1(), bz = 0;
-    double bx = 0, by = 0;
-    int x2 = line.x2(), y2 = line.y2();
-    double radius = sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
-    radius = (radius > height / 4) ? height /4 : radius;
-    float Ia = 228, I0 = 228;
-    double ka = 0.5, kd = 0.8, ks = 0.3;
-    int n = 2;
-
-    qDebug() << bx << by << radius;
-    int i = 0, j;
-    float Imax = 0, Imin = 999999;
-    for (double u = -PI / 2; u < PI * 3 / 2; u += PI / 32)
+    int w = width(), h = height();
+    if (!m_bCacheValid || m_cache.width() != w || m_cache.height() != h)
+    {
+        m_cache.resize(w, h);
+        m_cache.clear();
+        m_cachedCount = 0;
+        m_cacheState = CurveState();
+        m_bCacheValid = true;
+        m_baseCount = -1;
+    }
+
+    // 除最后一个图元外，其余图元都不会再改变，只需光栅化一次进缓存。
+    // 画到第一个三维图元时先把缓存存一份快照，见invalidate3D
+    int last = m_elements.size() - 1;
+    int first = first3DElement();
+    while (m_cachedCount < last)
     {
-        j = 0;
-        for (double v = 0; v < 2 * PI; v += PI / 32)
+        if (m_cachedCount == first && m_baseCount != first)
         {
-            p3d[i][j].x = bx + radius * cos(u) * cos(v);
-            p3d[i][j].y = by + radius * cos(u) * sin(v);
-            p3d[i][j].z = bz + radius * sin(u);
-            p3d[i][j].xn = p3d[i][j].x / radius;
-            p3d[i][j].yn = p3d[i][j].y / radius;
-            p3d[i][j].zn = p3d[i][j].z / radius;
-            float cosfi = getVectorAngle(p3d[i][j].xn, p3d[i][j].yn, p3d[i][j].zn, -lx, -ly, -lz);
-            float cosnh = getVectorAngle((-lx + vx)/2, (-ly + vy)/2, (-lz + vz)/2, p3d[i][j].xn,
-                                         p3d[i][j].yn, p3d[i][j].zn);
-            float I = Ia * ka + kd * I0 * cosfi + ks * I0 * pow(cosnh, n);
-            if (I < Imin)   Imin = I;
-            if (I > Imax)   Imax = I;
-            j++;
+            m_base.resize(w, h);
+            m_base.copyFrom(m_cache, QRect(0, 0, w, h));
+            m_baseState = m_cacheState;
+            m_baseCount = first;
         }
-        i++;
+        renderElement(&m_cache, m_cachedCount++, m_cacheState);
     }
-    countx = i;
-    county = j;
-
-    double ymax, ymin, ymid;
-    double xmin, xmax;
-    double nax, nay, naz, nbx, nby, nbz;
-    double dnpx, dnpy, dnpz;
-    double xa, xb;
-    double xn, yn, zn;
-
-    int nnn0 = 0;
-    for (i = 0; i < countx; i++)
+
+    // 只重画本次需要刷新的区域
+    m_target.resize(w, h);
+    QRect dirty(0, 0, w, h);
+    if (painter->hasClipping())
+        dirty &= painter->clipBoundingRect().toAlignedRect();
+    if (dirty.isEmpty())
+        return;
+    m_target.copyFrom(m_cache, dirty);
+    m_target.setClipRect(dirty);
+    if (last >= 0)
     {
-        for (j = 0; j < county; j++)
-        {
-            TriSurfaceN surface1, surface2;
-            surface1.p1 = p3d[i][j];
-            surface1.p2 = p3d[(i + 1) % countx][(j + 1) % county];
-            surface1.p3 = p3d[(i + 1) % countx][j];
+        CurveState state = m_cacheState;
+        renderElement(&m_target, last, state);
+    }
+    painter->drawImage(dirty.topLeft(), m_target.image(), dirty);
+}
 
-            surface2.p1 = p3d[i][j];
-            surface2.p2 = p3d[i][(j + 1) % county];
-            surface2.p3 = p3d[(i + 1) % countx][(j + 1) % county];
+void Painter::invalidateCache()
+{
+    m_bCacheValid = false;
+    m_baseCount = -1;
+}
 
-            surfaceList.append(surface1);
-            surfaceList.append(surface2);
-        }
+// 观察方向、相机或细分精度改变后，所有三维图元的几何缓冲都要重建
+void Painter::invalidateGeometry()
+{
+    m_geometryStamp++;
+    invalidate3D();
+}
+
+// 第一个三维图元的下标，没有时为-1
+int Painter::first3DElement() const
+{
+    for (int i = 0; i < m_elements.size(); i++)
+    {
+        if (m_elements.at(i)->m_pfunc == 8 || m_elements.at(i)->m_pfunc == 9)
+            return i;
     }
-    qDebug() << surfaceList.size() << nnn0 << Imin << Imax;
-
-    Imin = (Imin < 1e-3) ? 0 : Imin;
-    QPointF ptmp[3];
-    bool** mask = new bool*[height];
-    for (i = 0; i < height; i++)
-        mask[i] = new bool[width];
-    for (i = 0; i < surfaceList.size(); i++)
+    return -1;
+}
+
+// 观察或光照方向改变只影响三维图元：缓存退回到第一个三维图元之前的快照，
+// 只重画从它开始的图元，前面的二维图元不用重新光栅化。快照多占一份画布大小的内存
+void Painter::invalidate3D()
+{
+    int first = first3DElement();
+    if (first < 0)
+        return;
+    if (m_bCacheValid && m_cachedCount > first)
     {
-        TriSurfaceN surface = surfaceList.at(i);
-        Point3D p10, p20, p30;
-        p10.x = surface.p1.x; p10.y = surface.p1.y; p10.z = surface.p1.z;
-        p20.x = surface.p2.x; p20.y = surface.p2.y; p20.z = surface.p2.z;
-        p30.x = surface.p3.x; p30.y = surface.p3.y; p30.z = surface.p3.z;
-        ptmp[0] = projection_v2(p10, vx, vy, vz, x1, y1);
-        ptmp[1] = projection_v2(p20, vx, vy, vz, x1, y1);
-        ptmp[2] = projection_v2(p30, vx, vy, vz, x1, y1);
-        Point3DN p100, p200, p300, p1, p2, p3;
-        p100 = surface.p1; p200 = surface.p2; p300 = surface.p3;
-        p100.px = ptmp[0].x(); p100.py = ptmp[0].y();
-        p200.px = ptmp[1].x(); p200.py = ptmp[1].y();
-        p300.px = ptmp[2].x(); p300.py = ptmp[2].y();
-
-        p3 = yminp(p100, p200, p300);
-        p2 = ymidp(p100, p200, p300);
-        p1 = ymaxp(p100, p200, p300);
-
-        ymax = (p1.py + 1);
-        ymid = (p2.py);
-        ymin = (p3.py - 1);
-
-        for (j = 0; j < height; j++)
-            memset(mask[j], 0, sizeof(bool) * width);
-        drawLine(painter, mask, QLineF(ptmp[0], ptmp[1]));
-        drawLine(painter, mask, QLineF(ptmp[1], ptmp[2]));
-        drawLine(painter, mask, QLineF(ptmp[2], ptmp[0]));
-
-        xmin = mymin(mymin(ptmp[0].x(), ptmp[1].x()), ptmp[2].x());
-        xmax = mymax(mymax(ptmp[0].x(), ptmp[1].x()), ptmp[2].x());
-
-        double p23 = sqrt((p2.px - p3.px) * (p2.px - p3.px) + (p2.py - p3.py) * (p2.py - p3.py));
-        double p31 = sqrt((p3.px - p1.px) * (p3.px - p1.px) + (p3.py - p1.py) * (p3.py - p1.py));
-        double p12 = sqrt((p2.px - p1.px) * (p2.px - p1.px) + (p2.py - p1.py) * (p2.py - p1.py));
-
-        for (int y = ymin; y <= ymax; y++)
+        if (m_baseCount == first)
         {
-            int mn0 = 0;
-            xa = xmin; xb = xmax;
-            for (int j = xmin; j <= xmax; j++)
-            {
-                if (mask[y][j] && mn0 == 0)
-                {
-                    xa = j;
-                    mn0++;
-                }
-                else if (mask[y][j])
-                {
-                    xb = j;
-                    mn0++;
-                }
-            }
-
-            if (mn0 >= 2)
-            {
-                if (xa != xb)
-                {
-                    if (y < ymid)
-                    {
-                        double p2a, p3a, p3b, p1b;
-                        p2a = sqrt((y - p2.py) * (y - p2.py) + (xa - p2.px) * (xa - p2.px));
-                        p3a = sqrt((y - p3.py) * (y - p3.py) + (xa - p3.px) * (xa - p3.px));
-                        p1b = sqrt((y - p1.py) * (y - p1.py) + (xb - p1.px) * (xb - p1.px));
-                        p3b = sqrt((y - p3.py) * (y - p3.py) + (xb - p3.px) * (xb - p3.px));
-                        if (p23 != 0)
-                        {
-                            nax = (p2a * p3.xn + p3a * p2.xn) / p23;
-                            nay = (p2a * p3.yn + p3a * p2.yn) / p23;
-                            naz = (p2a * p3.zn + p3a * p2.zn) / p23;
-                        }
-                        else
-                        {
-                            nax = p2.xn; nay = p2.yn; naz = p2.zn;
-                        }
-                        if (p31 != 0)
-                        {
-                            nbx = (p3b * p1.xn + p1b * p3.xn) / p31;
-                            nby = (p3b * p1.yn + p1b * p3.yn) / p31;
-                            nbz = (p3b * p1.zn + p1b * p3.zn) / p31;
-                        }
-                        else
-                        {
-                            nbx = p1.xn; nby = p1.yn; nbz = p1.zn;
-                        }
-                    }
-                    else
-                    {
-                        double p2a, p1a, p3b, p1b;
-                        p2a = sqrt((y - p2.py) * (y - p2.py) + (xa - p2.px) * (xa - p2.px));
-                        p1a = sqrt((y - p1.py) * (y - p1.py) + (xa - p1.px) * (xa - p1.px));
-                        p1b = sqrt((y - p1.py) * (y - p1.py) + (xb - p1.px) * (xb - p1.px));
-                        p3b = sqrt((y - p3.py) * (y - p3.py) + (xb - p3.px) * (xb - p3.px));
-                        if (p12 != 0)
-                        {
-                            nax = (p2a * p1.xn + p1a * p2.xn) / p12;
-                            nay = (p2a * p1.yn + p1a * p2.yn) / p12;
-                            naz = (p2a * p1.zn + p1a * p2.zn) / p12;
-                        }
-                        else
-                        {
-                            nax = p2.xn; nay = p2.yn; naz = p2.zn;
-                        }
-                        if (p31 != 0)
-                        {
-                            nbx = (p3b * p1.xn + p1b * p3.xn) / p31;
-                            nby = (p3b * p1.yn + p1b * p3.yn) / p31;
-                            nbz = (p3b * p1.zn + p1b * p3.zn) / p31;
-                        }
-                        else
-                        {
-                            nbx = p1.xn; nby = p1.yn; nbz = p1.zn;
-                        }
-                    }
-                    double len = sqrt(nax * nax + nay * nay + naz * naz);
-                    nax /= len; nay /= len; naz /= len;
-                    len = sqrt(nbx * nbx + nby * nby + nbz * nbz);
-                    nbx /= len; nby /= len; nbz /= len;
-                    dnpx = (nbx - nax) / (xb - xa);
-                    dnpy = (nby - nay) / (xb - xa);
-                    dnpz = (nbz - naz) / (xb - xa);
-                }
-                else
-                {
-                    nax = p3.xn; nay = p3.yn; naz = p3.zn;
-                    dnpx = dnpy = dnpz = 0;
-                }
-                xn = nax; yn = nay; zn = naz;
-                for (double j = xa - 1; j <= xb + 1; j++)
-                {
-                    if (getVectorAngle(xn, yn, zn, vx, vy, vz) < 0)
-                        continue;
-
-                    float cosfi = getVectorAngle(xn, yn, zn, -lx, -ly, -lz);
-                    float cosnh = getVectorAngle((-lx + vx)/2, (-ly + vy)/2, (-lz + vz)/2, xn, yn, zn);
-                    float I = Ia * ka + kd * I0 * cosfi + ks * I0 * pow(cosnh, n);
-                    I = (I - Imin) / (Imax - Imin);
-
-                    double rtmp, gtmp, btmp;
-                    double u, v;
-
-                    u = atan(xn / yn);
-                    v = atan(sqrt(xn * xn + yn * yn) / zn);
-                    int t = u * 8 + v * 8;
-                    if (t % 2 == 1)
-                    {
-                        rtmp = 0; gtmp = 0; btmp = 0;
-                    }
-                    else
-                    {
-                        rtmp = qRed(rgb); gtmp = qGreen(rgb); btmp = qBlue(rgb);
-                    }
-
-                    rtmp = rtmp * I;
-                    rtmp = rtmp > 255 ? 255 : rtmp;
-                    rtmp = rtmp < 0 ? 0 : rtmp;
-                    gtmp = gtmp * I;
-                    gtmp = gtmp > 255 ? 255 : gtmp;
-                    gtmp = gtmp < 0 ? 0 : gtmp;
-                    btmp = btmp * I;
-                    btmp = btmp > 255 ? 255 : btmp;
-                    btmp = btmp < 0 ? 0 : btmp;
-                    uchar r = rtmp;
-                    uchar g = gtmp;
-                    uchar b = btmp;
-                    painter->setPen(QColor(r, g, b));
-                    painter->drawPoint(j, y);
-                    xn += dnpx;
-                    yn += dnpy;
-                    zn += dnpz;
-                }
-            }
+            m_cache.copyFrom(m_base, QRect(0, 0, m_cache.width(), m_cache.height()));
+            m_cacheState = m_baseState;
+            m_cachedCount = first;
         }
+        else
+            invalidateCache();
     }
+    update();
+}
 
-    for (int i = 0; i < height; i++)
+// 第i个图元的包围盒，填充和曲线还要包括它依赖的前面图元
+QRect Painter::elementRect(int i) const
+{
+    ElementGroup *element = m_elements.at(i);
+    QRect rect = element->boundingRect(height());
+    int func = element->m_pfunc;
+    if (func == 3 && i > 0 && m_elements.at(i - 1)->m_pfunc == 2)
+    {
+        rect |= m_elements.at(i - 1)->boundingRect(height());
+    }
+    else if (func == 3)
     {
-        delete[] mask[i];
-        mask[i] = NULL;
+        for (int j = i - 1; j >= 0 && m_elements.at(j)->m_pfunc == 1; j--)
+            rect |= m_elements.at(j)->boundingRect(height());
     }
-    delete[] mask;
-    mask = NULL;
+    else if (func == 4 || func == 5)
+    {
+        for (int j = i - 1; j >= 0 && m_elements.at(j)->m_pfunc == func; j--)
+            rect |= m_elements.at(j)->boundingRect(height());
+    }
+    else if ((func == 8 || func == 9) && m_bPerspective && !element->m_lines.isEmpty())
+    {
+        // 透视投影下离视点近的部分会放大
+        rect |= sphereRect(element->m_lines.last()).toAlignedRect().adjusted(-2, -2, 2, 2);
+    }
+    return rect;
 }
 
-
-
-void Painter::paint(QPainter *painter)
+// 最后一个图元改变后，只刷新它新旧包围盒的并集
+void Painter::updateLiveElement()
 {
-    painter->setRenderHint(QPainter::Antialiasing);
+    QRect rect = elementRect(m_elements.size() - 1);
+    update(rect | m_liveRect);
+    m_liveRect = rect;
+}
 
+// 绘制第i个图元，state保存贝塞尔/B样条跨图元累积的控制点
+void Painter::renderElement(RasterTarget *target, int i, CurveState &state)
+{
     int size = m_elements.size();
-    ElementGroup *element;
-    QVector<QPointF> BezierP;
-    QVector<QPointF> BsplineP;
-    for (int i = 0; i < size; i++)
+    ElementGroup *element = m_elements.at(i);
+    int size1 = element->m_lines.size();
+    if (size1 == 0)
+        return;
+    QVector<QPointF> &BezierP = state.BezierP;
+    QVector<QPointF> &BsplineP = state.BsplineP;
+    // 整个图元都在裁剪区外时直接跳过；贝塞尔和B样条要累积控制点，不能跳过
+    int func = element->m_pfunc;
+    if (func != 4 && func != 5 && !elementRect(i).intersects(target->clipRect()))
+        return;
+    target->setPen(element->m_pen);
+    switch (element->m_pfunc)
     {
-        element = m_elements.at(i);
-        int size1 = element->m_lines.size();
-        painter->setPen(element->m_pen);
-        switch (element->m_pfunc)
-        {
-        case 1:
-        {
-            drawLine(painter, element->m_lines.at(size1 - 1));
-            break;
-        }
-
-        case 2:
-        {
-            drawEllipse(painter, element->m_lines.at(size1 - 1), element->m_era,
-                        element->m_erb, element->m_eangle);
-            break;
-        }
-        case 3:
-        {
-            QPaintDevice* qpd =  painter->device();
-            int height = qpd->height(), width = qpd->width();
-            bool** tmp = new bool*[height];
-            for (int k = 0; k < height; k++)
-            {
-                tmp[k] = new bool[width];
-                memset(tmp[k], 0, sizeof(bool) * width);
-            }
+    case 1:
+    {
+        drawLine(*target, element->m_lines.at(size1 - 1), target->strokeClipRect());
+        break;
+    }
 
-           if (i > 0 && m_elements.at(i - 1)->m_pfunc == 2)
-           {
-               int x1 = element->m_lines.at(size1 - 1).x1();
-               int y1 = element->m_lines.at(size1 - 1).y1();
-               int size2 =  m_elements.at(i - 1)->m_lines.size();
-               int xc = m_elements.at(i - 1)->m_lines.at(size2 - 1).x2();
-               int yc = m_elements.at(i - 1)->m_lines.at(size2 - 1).y2();
-               float ra = m_elements.at(i - 1)->m_era;
-               float rb = m_elements.at(i - 1)->m_erb;
-               float ang = m_elements.at(i - 1)->m_eangle;
-               fill_ellipse(painter, x1, y1, xc, yc, ra, rb, ang, tmp);
-           }
-           else if (i > 0 && m_elements.at(i - 1)->m_pfunc == 1)
+    case 2:
+    {
+        drawEllipse(*target, element->m_lines.at(size1 - 1), element->m_era,
+                    element->m_erb, element->m_eangle);
+        break;
+    }
+    case 3:
+    {
+       if (i > 0 && m_elements.at(i - 1)->m_pfunc == 2)
+       {
+           int x1 = element->m_lines.at(size1 - 1).x1();
+           int y1 = element->m_lines.at(size1 - 1).y1();
+           int size2 =  m_elements.at(i - 1)->m_lines.size();
+           int xc = m_elements.at(i - 1)->m_lines.at(size2 - 1).x2();
+           int yc = m_elements.at(i - 1)->m_lines.at(size2 - 1).y2();
+           float ra = m_elements.at(i - 1)->m_era;
+           float rb = m_elements.at(i - 1)->m_erb;
+           float ang = m_elements.at(i - 1)->m_eangle;
+           fill_ellipse(target, x1, y1, xc, yc, ra, rb, ang);
+       }
+       else if (i > 0 && m_elements.at(i - 1)->m_pfunc == 1)
+       {
+           // 前面连续的直线首尾相接，构成一个封闭多边形
+           int first = i - 1;
+           while (first > 0 && m_elements.at(first - 1)->m_pfunc == 1)
+               first--;
+           QVector<QPointF> polygon;
+           for (int j = first; j < i; j++)
            {
-               int size2 =  m_elements.at(i - 1)->m_lines.size();
-               QPointF p3 = m_elements.at(i - 1)->m_lines.at(size2 - 1).p2();
-               QPointF p2 = m_elements.at(i - 1)->m_lines.at(size2 - 1).p1();
-               QPointF p1;
-               for (int j = i - 2; j > 0 && m_elements.at(j)->m_pfunc == 1; j++)
-               {
-                   int sizej = m_elements.at(j)->m_lines.size();
-                   p1 = m_elements.at(j)->m_lines.at(sizej - 1).p1();
-                   fill_triangle(painter, p1, p2, p3, tmp, height, width);
-               }
+               if (!m_elements.at(j)->m_lines.isEmpty())
+                   polygon.append(m_elements.at(j)->m_lines.last().p1());
            }
-            for (int k = 0; k < height; k++)
-            {
-                delete[] tmp[k];
-                tmp[k] = NULL;
-            }
-            tmp = NULL;
-            break;
-        }
-        case 4:
+           if (!m_elements.at(i - 1)->m_lines.isEmpty())
+               polygon.append(m_elements.at(i - 1)->m_lines.last().p2());
+           QRect rows = target->strokeClipRect() & QRect(0, 0, target->width(), target->height());
+           fillPolygon(*target, polygon, rows.top(), rows.bottom());
+       }
+        break;
+    }
+    case 4:
+    {
+        drawLine(*target, element->m_lines.at(size1 - 1), target->strokeClipRect());
+        if (BezierP.size() == 0)
+            BezierP.append(element->m_lines.at(size1 - 1).p1());
+        if (BezierP.size()== element->m_beSize)
         {
-            drawLine(painter, element->m_lines.at(size1 - 1));
-            if (BezierP.size() == 0)
-                BezierP.append(element->m_lines.at(size1 - 1).p1());
-            if (BezierP.size()== element->m_beSize)
+            BezierP.append(element->m_lines.at(size1 - 1).p2());
+            if ((i + 1) == size || BezierP.size() != m_elements.at(i + 1)->m_beSize)
             {
-                BezierP.append(element->m_lines.at(size1 - 1).p2());
-                if ((i + 1) == size || BezierP.size() != m_elements.at(i + 1)->m_beSize)
-                {
-                    bezier(painter, &BezierP);
-                    BezierP.clear();
-                }
+                bezier(*target, &BezierP);
+                BezierP.clear();
             }
-            break;
         }
-        case 5:
+        break;
+    }
+    case 5:
+    {
+        drawLine(*target, element->m_lines.at(size1 - 1), target->strokeClipRect());
+        if (BsplineP.size() == 0)
+            BsplineP.append(element->m_lines.at(size1 - 1).p1());
+        if (BsplineP.size() == element->m_bsSize)
         {
-            drawLine(painter, element->m_lines.at(size1 - 1));
-            if (BsplineP.size() == 0)
-                BsplineP.append(element->m_lines.at(size1 - 1).p1());
-            if (BsplineP.size() == element->m_bsSize)
+            BsplineP.append(element->m_lines.at(size1 - 1).p2());
+            if (((i + 1) == size || BsplineP.size() != m_elements.at(i + 1)->m_bsSize))
             {
-                BsplineP.append(element->m_lines.at(size1 - 1).p2());
-                if (((i + 1) == size || BsplineP.size() != m_elements.at(i + 1)->m_bsSize))
-                {
-                    bspline(painter, &BsplineP);
-                    BsplineP.clear();
-                }
+                bspline(*target, &BsplineP);
+                BsplineP.clear();
             }
-            break;
         }
-        case 6:
+        break;
+    }
+    case 6:
+    {
+            QVector<QLineF> segments;
+            Koch(segments, element->m_lines.at(size1 - 1), element->m_kochSize);
+            QPointF tmp1 = element->m_lines.at(size1 - 1).p1();
+            QPointF tmp2 = element->m_lines.at(size1 - 1).p2();
+            QPointF tmp3;
+            int dx = tmp2.x() - tmp1.x();
+            int dy = tmp2.y() - tmp1.y();
+            tmp3.setX(tmp1.x() + (dx + dy * sqrt(3)) / 2);
+            tmp3.setY(tmp1.y() + (dy - sqrt(3) * dx) / 2);
+            QLineF tmp;
+            tmp.setP1(tmp2);    tmp.setP2(tmp3);
+            Koch(segments, tmp, element->m_kochSize);
+            tmp.setP1(tmp3);    tmp.setP2(tmp1);
+            Koch(segments, tmp, element->m_kochSize);
+            drawLines(*target, segments.constData(), segments.size(), target->strokeClipRect());
+        break;
+    }
+    case 7:
+    {
+        target->setColor(QColor("green"));
+        ferns(*target, element->m_lines.at(size1 - 1));
+        break;
+    }
+    case 8:
+    case 9:
+    {
+        QLineF line = element->m_lines.at(size1 - 1);
+        bool textured = element->m_pfunc == 9;
+        float tmpv = sqrt(m_vThetax * m_vThetax + m_vThetay * m_vThetay + m_vThetaz * m_vThetaz);
+        float vx = m_vThetax / tmpv, vy = m_vThetay / tmpv, vz = m_vThetaz / tmpv;
+        const SphereMesh &mesh = sphereMesh(sphereLevel(line));
+        Light main = { false, QVector3D(m_lThetax, m_lThetay, m_lThetaz), m_lightColor, double(m_lightIntensity) };
+        QVector<ShadeLight> lights = sphereShadeLights(QVector<Light>() << main << m_lights,
+                                                       camera(), line, vx, vy, vz);
+        ShadeParams params = sphereShadeParams(element->m_material, element->m_pen.color().rgb(),
+                                               lights, m_ambientLight, vx, vy, vz);
+        const Texture *texture = textured ? &m_texture : 0;
+
+        // 正在拖动的球体先用Gouraud着色，松开鼠标后再按Phong重画。解析模式没有网格，总是逐像素着色
+        int shading = m_shadingMode;
+        if (shading == 0 && m_bPressed && i == size - 1)
+            shading = 1;
+        if (shading != 0 && m_sphereMode == 0)
         {
-                Koch(painter, element->m_lines.at(size1 - 1), element->m_kochSize);
-                QPointF tmp1 = element->m_lines.at(size1 - 1).p1();
-                QPointF tmp2 = element->m_lines.at(size1 - 1).p2();
-                QPointF tmp3;
-                int dx = tmp2.x() - tmp1.x();
-                int dy = tmp2.y() - tmp1.y();
-                tmp3.setX(tmp1.x() + (dx + dy * sqrt(3)) / 2);
-                tmp3.setY(tmp1.y() + (dy - sqrt(3) * dx) / 2);
-                QLineF tmp;
-                tmp.setP1(tmp2);    tmp.setP2(tmp3);
-                Koch(painter, tmp, element->m_kochSize);
-                tmp.setP1(tmp3);    tmp.setP2(tmp1);
-                Koch(painter, tmp, element->m_kochSize);
+            sphereShading(target, mesh, camera(), line, params, texture, m_bSmoothTexture, shading == 2);
             break;
         }
 
-        case 7:
-        {
-            ferns(painter, element->m_lines.at(size1 - 1));
-            break;
-        }
-        case 8:
-        {
-            float tmpl = sqrt(m_lThetax * m_lThetax + m_lThetay * m_lThetay + m_lThetaz * m_lThetaz);
-            float tmpv = sqrt(m_vThetax * m_vThetax + m_vThetay * m_vThetay + m_vThetaz * m_vThetaz);
-            sphere(painter, element->m_lines.at(size1 - 1), element->m_pen.color().rgb(),
-                   m_lThetax / tmpl, m_lThetay / tmpl, m_lThetaz / tmpl,
-                   m_vThetax / tmpv, m_vThetay / tmpv, m_vThetaz / tmpv);
-            break;
-        }
-        case 9:
+        // 几何缓冲只在图元本身、观察方向或相机改变后重建，光照改变时直接重新着色
+        if (!element->m_gbuffer)
+            element->m_gbuffer = QSharedPointer<GBuffer>(new GBuffer);
+        GBuffer &g = *element->m_gbuffer;
+        if (g.stamp != m_geometryStamp || g.line != line)
         {
-            float tmpl = sqrt(m_lThetax * m_lThetax + m_lThetay * m_lThetay + m_lThetaz * m_lThetaz);
-            float tmpv = sqrt(m_vThetax * m_vThetax + m_vThetay * m_vThetay + m_vThetaz * m_vThetaz);
-            sphere_texture(painter, element->m_lines.at(size1 - 1), element->m_pen.color().rgb(),
-                       m_lThetax / tmpl, m_lThetay / tmpl, m_lThetaz / tmpl,
-                       m_vThetax / tmpv, m_vThetay / tmpv, m_vThetaz / tmpv);
-            break;
-         }
-        default:
-            qDebug() << "朋友，请按规范操作";
+            sphereGeometry(g, mesh, camera(), line, vx, vy, vz, textured, m_sphereMode);
+            g.stamp = m_geometryStamp;
+            g.line = line;
         }
+        sphereLighting(target, g, params, texture, m_bSmoothTexture,
+                       m_lightTable > 0 ? &m_phongTable : 0, m_lightTable);
+        break;
+    }
+    default:
+        qDebug() << "朋友，请按规范操作";
     }
 }
 
@@ -1527,8 +1355,10 @@ void Painter::mousePressEvent(QMouseEvent *event)
         else
             m_element = new ElementGroup(m_pen, m_pfunc, m_era, m_erb, m_eangle
                                          , m_beSize, m_bsSize, m_kochSize);
+        m_element->m_material = m_material;
 
         m_elements.append(m_element);
+        m_liveRect = QRect();
         m_lastPoint = event->localPos();
         m_firstPoint = m_lastPoint;
         event->setAccepted(true);
@@ -1545,7 +1375,7 @@ void Painter::mouseMoveEvent(QMouseEvent *event)
     {
         m_element->m_lines.append(QLineF(m_firstPoint, event->localPos()));
         m_lastPoint = event->localPos();
-        update();
+        updateLiveElement();
     }
 }
 
@@ -1560,7 +1390,7 @@ void Painter::mouseReleaseEvent(QMouseEvent *event)
         m_bPressed = false;
         m_bMoved = false;
         m_element->m_lines.append(QLineF(m_firstPoint, event->localPos()));
-        update();
+        updateLiveElement();
     }
 }
 
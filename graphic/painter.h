@@ -5,8 +5,17 @@
 #include <QPointF>
 #include <QLineF>
 #include <QPen>
-#include <QStack>
+#include <QRect>
 #include <math.h>
+#include <QHash>
+#include <QMatrix4x4>
+#include <QVector3D>
+#include <QSharedPointer>
+#include "rastertarget.h"
+#include "spheremesh.h"
+#include "gbuffer.h"
+#include "shadekernel.h"
+#include "texture.h"
 
 #define PI 3.1415926
 
@@ -19,6 +28,15 @@ struct Complex
     double c;
 };
 
+// 三维图元的材质：环境光、漫反射、镜面反射系数和镜面反射指数，颜色取画笔的颜色
+struct Material
+{
+    Material() : ka(0.5), kd(0.8), ks(0.3), shininess(2) {}
+
+    double ka, kd, ks;
+    int shininess;
+};
+
 class ElementGroup
 {
 public:
@@ -46,6 +64,8 @@ public:
         m_beSize = e.m_beSize;
         m_bsSize = e.m_bsSize;
         m_kochSize = e.m_kochSize;
+        m_material = e.m_material;
+        m_gbuffer = e.m_gbuffer;
     }
 
     ElementGroup & operator=(const ElementGroup &e)
@@ -58,12 +78,16 @@ public:
             m_bsSize = e.m_bsSize;
             m_beSize = e.m_beSize;
             m_kochSize = e.m_kochSize;
+            m_material = e.m_material;
+            m_gbuffer = e.m_gbuffer;
         }
         return *this;
     }
 
     ~ElementGroup(){}
 
+    QRect boundingRect(int canvasHeight) const;
+
     QVector<QLineF> m_lines;
     QPen m_pen;
     int m_pfunc;
@@ -73,6 +97,39 @@ public:
     int m_beSize;
     int m_bsSize;
     int m_kochSize;
+    Material m_material; // 三维图元的材质，创建时取当时的设置
+    QSharedPointer<GBuffer> m_gbuffer; // 球体图元的几何缓冲
+};
+
+// 贝塞尔曲线和B样条的控制点跨多个图元累积
+struct CurveState
+{
+    QVector<QPointF> BezierP;
+    QVector<QPointF> BsplineP;
+};
+
+// 三维图元的相机。画布坐标以像素为单位，x向右、y向下、z指向观察者，画布在z=0平面上。
+// view只绕各物体自身的中心旋转（由观察方向决定），物体仍画在点击的位置；
+// projection包含视点的位置，画布平面上的点投影后仍落在原来的像素上
+struct Camera
+{
+    QMatrix4x4 view;
+    QMatrix4x4 projection;
+    bool perspective;
+    double distance; // 视点到画布平面的距离
+    int width, height;
+
+    QPointF project(double x, double y, double z) const;
+};
+
+// 三维图元的光源。方向光的position为光线的传播方向，与lthetax/y/z一样在物体自身的坐标中；
+// 点光源的position为画布坐标中的位置。color乘以intensity为各通道的光强，不随距离衰减
+struct Light
+{
+    bool point;
+    QVector3D position;
+    QColor color;
+    double intensity;
 };
 
 class Painter : public QQuickPaintedItem
@@ -91,6 +148,23 @@ class Painter : public QQuickPaintedItem
     Q_PROPERTY(int lthetay READ lthetay WRITE setLthetay)
     Q_PROPERTY(int vthetaz READ vthetaz WRITE setVthetaz)
     Q_PROPERTY(int lthetaz READ lthetaz WRITE setLthetaz)
+    Q_PROPERTY(int quality READ quality WRITE setQuality)
+    Q_PROPERTY(int sphereMode READ sphereMode WRITE setSphereMode)
+    Q_PROPERTY(int lightTable READ lightTable WRITE setLightTable)
+    Q_PROPERTY(QString texture READ texture WRITE setTexture)
+    Q_PROPERTY(bool smoothTexture READ smoothTexture WRITE setSmoothTexture)
+    Q_PROPERTY(int shadingMode READ shadingMode WRITE setShadingMode)
+    Q_PROPERTY(QColor lightColor READ lightColor WRITE setLightColor)
+    Q_PROPERTY(int lightIntensity READ lightIntensity WRITE setLightIntensity)
+    Q_PROPERTY(int ambientLight READ ambientLight WRITE setAmbientLight)
+    Q_PROPERTY(qreal ka READ ka WRITE setKa)
+    Q_PROPERTY(qreal kd READ kd WRITE setKd)
+    Q_PROPERTY(qreal ks READ ks WRITE setKs)
+    Q_PROPERTY(int shininess READ shininess WRITE setShininess)
+    Q_PROPERTY(bool perspective READ perspective WRITE setPerspective NOTIFY cameraChanged)
+    Q_PROPERTY(int fov READ fov WRITE setFov NOTIFY cameraChanged)
+    Q_PROPERTY(QMatrix4x4 viewMatrix READ viewMatrix NOTIFY cameraChanged)
+    Q_PROPERTY(QMatrix4x4 projectionMatrix READ projectionMatrix NOTIFY cameraChanged)
     Q_PROPERTY(QWidget* widget READ widget WRITE setWidget)
 
 public:
@@ -101,22 +175,78 @@ public:
     void setWidget(QWidget * widget) { m_widget = widget; }
 
     int vthetax() { return m_vThetax; }
-    void setVthetax(int vTheta) { m_vThetax = vTheta; }
+    void setVthetax(int vTheta) { if (m_vThetax != vTheta) { m_vThetax = vTheta; invalidateGeometry(); emit cameraChanged(); } }
 
     int vthetay() { return m_vThetay; }
-    void setVthetay(int vTheta) { m_vThetay = vTheta; }
+    void setVthetay(int vTheta) { if (m_vThetay != vTheta) { m_vThetay = vTheta; invalidateGeometry(); emit cameraChanged(); } }
 
     int vthetaz() { return m_vThetaz; }
-    void setVthetaz(int vTheta) { m_vThetaz = vTheta; }
+    void setVthetaz(int vTheta) { if (m_vThetaz != vTheta) { m_vThetaz = vTheta; invalidateGeometry(); emit cameraChanged(); } }
 
     int lthetax() { return m_lThetax; }
-    void setLthetax(int lTheta) { m_lThetax = lTheta; }
+    void setLthetax(int lTheta) { if (m_lThetax != lTheta) { m_lThetax = lTheta; invalidate3D(); } }
 
     int lthetay() { return m_lThetay; }
-    void setLthetay(int lTheta) { m_lThetay = lTheta; }
+    void setLthetay(int lTheta) { if (m_lThetay != lTheta) { m_lThetay = lTheta; invalidate3D(); } }
 
     int lthetaz() { return m_lThetaz; }
-    void setLthetaz(int lTheta) { m_lThetaz = lTheta; }
+    void setLthetaz(int lTheta) { if (m_lThetaz != lTheta) { m_lThetaz = lTheta; invalidate3D(); } }
+
+    // 球面细分精度，1~10，越大三角形越小
+    int quality() const { return m_quality; }
+    void setQuality(int quality);
+
+    // 球体绘制方式：0为三角网格光栅化，1为逐像素解析求交
+    int sphereMode() const { return m_sphereMode; }
+    void setSphereMode(int mode);
+
+    // 光照查找表的边长，16~1024，0为逐像素直接计算光照。边长越小误差越大，见PhongTable::defaultSize
+    int lightTable() const { return m_lightTable; }
+    void setLightTable(int size);
+
+    // 球体纹理映射的贴图，为空时用棋盘格；smoothTexture为假时纹素取最近的，不做插值
+    QString texture() const { return m_textureSource; }
+    void setTexture(const QString &source);
+    bool smoothTexture() const { return m_bSmoothTexture; }
+    void setSmoothTexture(bool smooth);
+
+    // 球体着色方式：0为逐像素Phong，1为逐顶点Gouraud，2为逐面平面着色。
+    // Gouraud和平面着色只用于三角网格模式
+    int shadingMode() const { return m_shadingMode; }
+    void setShadingMode(int mode);
+
+    // 主光源的颜色和强度，方向由lthetax/y/z给出；ambientLight为环境光强度
+    QColor lightColor() const { return m_lightColor; }
+    void setLightColor(const QColor &color);
+    int lightIntensity() const { return m_lightIntensity; }
+    void setLightIntensity(int intensity);
+    int ambientLight() const { return m_ambientLight; }
+    void setAmbientLight(int intensity);
+
+    // 之后画的三维图元的材质，已画好的不变
+    qreal ka() const { return m_material.ka; }
+    void setKa(qreal ka) { m_material.ka = qBound(0.0, ka, 1.0); }
+    qreal kd() const { return m_material.kd; }
+    void setKd(qreal kd) { m_material.kd = qBound(0.0, kd, 1.0); }
+    qreal ks() const { return m_material.ks; }
+    void setKs(qreal ks) { m_material.ks = qBound(0.0, ks, 1.0); }
+    int shininess() const { return m_material.shininess; }
+    void setShininess(int n) { m_material.shininess = qBound(0, n, 128); }
+
+    // 主光源之外的光源：point为真时(x, y, z)为画布坐标中的位置，否则为光线方向。返回光源的下标
+    Q_INVOKABLE int addLight(bool point, qreal x, qreal y, qreal z, const QColor &color, qreal intensity);
+    Q_INVOKABLE void removeLight(int index);
+    Q_INVOKABLE void clearLights();
+
+    // 透视投影或平行投影，fov为透视投影的竖直视角（度）
+    bool perspective() const { return m_bPerspective; }
+    void setPerspective(bool perspective);
+    int fov() const { return m_fov; }
+    void setFov(int fov);
+
+    QMatrix4x4 viewMatrix() const;
+    QMatrix4x4 projectionMatrix() const;
+    Camera camera() const;
 
     bool isEnabled() const {return m_bEnabled;}
     void setEnabled(bool enabled) { m_bEnabled = enabled; }
@@ -145,11 +275,25 @@ public:
     void paint(QPainter *painter);
     QWidget* m_widget;
 
+signals:
+    void cameraChanged();
+
 protected:
+    void geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry);
     void mousePressEvent(QMouseEvent *event);
     void mouseMoveEvent(QMouseEvent *event);
     void mouseReleaseEvent(QMouseEvent *event);
     void purgePaintElements();
+    void renderElement(RasterTarget *target, int i, CurveState &state);
+    void invalidateCache();
+    void invalidate3D();
+    int first3DElement() const;
+    void invalidateGeometry();
+    QRect elementRect(int i) const;
+    void updateLiveElement();
+    const SphereMesh &sphereMesh(int level);
+    int sphereLevel(const QLineF &line) const;
+    QRectF sphereRect(const QLineF &line) const;
 
 protected:
     QPointF m_lastPoint;
@@ -167,6 +311,32 @@ protected:
     int m_beSize;
     int m_bsSize;
     int m_kochSize;
+    RasterTarget m_target; // 所有图元先光栅化到此，再一次性贴图
+    RasterTarget m_cache; // 已提交图元的光栅缓存
+    CurveState m_cacheState; // 缓存末尾的曲线控制点状态
+    int m_cachedCount; // 缓存中已包含的图元数
+    bool m_bCacheValid;
+    RasterTarget m_base; // 缓存画到第一个三维图元之前时的快照
+    CurveState m_baseState;
+    int m_baseCount; // 快照中已包含的图元数，为-1时快照无效
+    QRect m_liveRect; // 最后一个图元上次刷新时的包围盒
+    QHash<int, SphereMesh> m_meshes; // 按细分级别缓存的球面网格
+    int m_quality;
+    int m_sphereMode;
+    bool m_bPerspective;
+    int m_fov;
+    int m_geometryStamp; // 几何版本号，几何缓冲与之不同时要重建
+    int m_lightTable;
+    PhongTable m_phongTable; // 按当前光照建好的查找表，所有球体图元共用
+    QString m_textureSource;
+    Texture m_texture;
+    bool m_bSmoothTexture;
+    int m_shadingMode;
+    QColor m_lightColor;
+    int m_lightIntensity;
+    int m_ambientLight;
+    QVector<Light> m_lights; // 主光源之外的光源
+    Material m_material; // 新图元的材质
     int m_vThetax;
     int m_lThetax;
     int m_vThetay;
@@ -181,30 +351,5 @@ struct Point3D {
     double y;
     double z;
 };
-struct Point3DN {
-    double x;
-    double y;
-    double z;
-    double xn;
-    double yn;
-    double zn;
-    double px, py;
-};
-
-// 三角面
-struct TriSurface {
-    int no; // 所属景物序号
-    Point3D p1, p2, p3;
-    double xn, yn, zn; // 三角面法向量
-    double I;
-};
-struct TriSurfaceN {
-    int no; // 所属景物序号
-    Point3DN p1, p2, p3;
-    double xn, yn, zn; // 三角面法向量
-    double I;
-};
-
-
 
 #endif // PAINTER_H
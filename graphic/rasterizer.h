@@ -0,0 +1,748 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+#include <QVector>
+#include <QPoint>
+#include <QPointF>
+#include <QLineF>
+#include <QRect>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+// 与shadekernel.cpp相同，SSE的部分用target属性单独编译，运行时按CPU选择，
+// 32位的MinGW默认不开SSE也能用上
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define RASTER_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+  统一的模板光栅化层：直线、椭圆、曲线和分形只依赖像素写入策略Sink，
+  Sink需提供 void plot(int x, int y)，以及整段写入的 hline(x0, x1, y) 和 vline(x, y0, y1)
+  （端点都包含在内，x0 <= x1，y0 <= y1），在编译期确定，内层循环中的写像素可以内联。
+  Sink的实现为RasterTarget（QImage扫描线）
+*/
+
+#ifndef PI
+#define PI 3.1415926
+#endif
+
+#ifndef mymax
+#define mymax(x, y) ((x) < (y) ? (y) : (x))
+#define mymin(x, y) ((x) > (y) ? (y) : (x))
+#endif
+
+template<class Sink>
+inline void plotPoint(Sink &sink, const QPointF &p)
+{
+    sink.plot(qRound(p.x()), qRound(p.y()));
+}
+
+// Run-slice直线算法：与Bresenham画出的像素完全相同，但按行（或列）整段输出。
+// 以x为主方向时，第j次y递增发生在第 k_j = ceil(dx(2j-1) / 2dy) 步，
+// 相邻两行的游程长度只可能是 dx/dy 或 dx/dy + 1，用余数累加决定。
+// 只输出副方向第[jbegin, jend]行，供裁剪后的直线直接从可见部分开始。
+template<class Sink>
+void drawLineRows(Sink &sink, int x1, int y1, int x2, int y2, int jbegin, int jend)
+{
+    int dx = abs(x2 - x1), dy = abs(y2 - y1);
+    int sx = (x2 < x1) ? -1 : 1, sy = (y2 < y1) ? -1 : 1;
+    bool xmajor = dy <= dx;
+    int dmaj = xmajor ? dx : dy, dmin = xmajor ? dy : dx;
+    if (dmin == 0)
+    {
+        if (xmajor)
+            sink.hline(mymin(x1, x2), mymax(x1, x2), y1);
+        else
+            sink.vline(x1, mymin(y1, y2), mymax(y1, y2));
+        return;
+    }
+
+    // k为当前行起始步数，next为下一行起始步数，
+    // e = next * 2dmin - dmaj(2j+1) 为向上取整的余量
+    int d2 = 2 * dmin, q = dmaj / dmin, r = 2 * (dmaj % dmin);
+    qint64 n = qint64(dmaj) * (2 * jbegin - 1);
+    int k = (jbegin == 0) ? 0 : int((n + d2 - 1) / d2);
+    n += 2 * dmaj;
+    int next = int((n + d2 - 1) / d2);
+    int e = int(qint64(next) * d2 - n);
+    int s = xmajor ? sx : sy;
+    int a = (xmajor ? x1 : y1), b = (xmajor ? y1 : x1) + (xmajor ? sy : sx) * jbegin;
+    int bstep = xmajor ? sy : sx;
+    for (int j = jbegin; j <= jend; j++)
+    {
+        int end = (j == dmin) ? dmaj : next - 1;
+        int lo = (s > 0) ? a + k : a - end, hi = (s > 0) ? a + end : a - k;
+        if (xmajor)
+            sink.hline(lo, hi, b);
+        else
+            sink.vline(b, lo, hi);
+        k = next;
+        next += q;
+        e -= r;
+        if (e < 0)
+        {
+            next++;
+            e += d2;
+        }
+        b += bstep;
+    }
+}
+
+template<class Sink>
+void drawLine(Sink &sink, QLineF line)
+{
+    int x1, y1, x2, y2;
+    x1 = line.x1(); y1 = line.y1();
+    x2 = line.x2(); y2 = line.y2();
+    drawLineRows(sink, x1, y1, x2, y2, 0, mymin(abs(x2 - x1), abs(y2 - y1)));
+}
+
+// Liang–Barsky裁剪：一次处理8条直线（SoA），结果为可见参数区间[t0, t1]，
+// t0 > t1表示整条线都在clip外。
+// 光栅化后的像素与理想直线在副方向上最多差半个像素，所以裁剪窗口四边各外扩一个像素
+inline void clipLines8Scalar(const float *x1, const float *y1, const float *x2, const float *y2,
+                             const QRect &clip, float *t0, float *t1)
+{
+    const float left = clip.left() - 1.0f, right = clip.right() + 1.0f;
+    const float top = clip.top() - 1.0f, bottom = clip.bottom() + 1.0f;
+    for (int i = 0; i < 8; i++)
+    {
+        float dx = x2[i] - x1[i], dy = y2[i] - y1[i];
+        float p[4] = { -dx, dx, -dy, dy };
+        float q[4] = { x1[i] - left, right - x1[i], y1[i] - top, bottom - y1[i] };
+        float lo = 0, hi = 1;
+        for (int b = 0; b < 4; b++)
+        {
+            if (p[b] == 0)
+            {
+                if (q[b] < 0)
+                    lo = 2;
+            }
+            else if (p[b] < 0)
+            {
+                lo = mymax(lo, q[b] / p[b]);
+            }
+            else
+            {
+                hi = mymin(hi, q[b] / p[b]);
+            }
+        }
+        t0[i] = lo;
+        t1[i] = hi;
+    }
+}
+
+#ifdef RASTER_SSE2
+// 每4条用一组向量指令，结果与clipLines8Scalar相同
+__attribute__((target("sse2")))
+inline void clipLines8SSE2(const float *x1, const float *y1, const float *x2, const float *y2,
+                           const QRect &clip, float *t0, float *t1)
+{
+    const __m128 xmin = _mm_set1_ps(clip.left() - 1.0f), xmax = _mm_set1_ps(clip.right() + 1.0f);
+    const __m128 ymin = _mm_set1_ps(clip.top() - 1.0f), ymax = _mm_set1_ps(clip.bottom() + 1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    for (int i = 0; i < 8; i += 4)
+    {
+        __m128 px1 = _mm_loadu_ps(x1 + i), py1 = _mm_loadu_ps(y1 + i);
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(x2 + i), px1);
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(y2 + i), py1);
+        __m128 p[4] = { _mm_sub_ps(zero, dx), dx, _mm_sub_ps(zero, dy), dy };
+        __m128 q[4] = { _mm_sub_ps(px1, xmin), _mm_sub_ps(xmax, px1),
+                        _mm_sub_ps(py1, ymin), _mm_sub_ps(ymax, py1) };
+        __m128 lo = zero, hi = _mm_set1_ps(1.0f), reject = zero;
+        for (int b = 0; b < 4; b++)
+        {
+            __m128 ratio = _mm_div_ps(q[b], p[b]);
+            __m128 neg = _mm_cmplt_ps(p[b], zero), pos = _mm_cmpgt_ps(p[b], zero);
+            lo = _mm_or_ps(_mm_and_ps(neg, _mm_max_ps(lo, ratio)), _mm_andnot_ps(neg, lo));
+            hi = _mm_or_ps(_mm_and_ps(pos, _mm_min_ps(hi, ratio)), _mm_andnot_ps(pos, hi));
+            reject = _mm_or_ps(reject, _mm_and_ps(_mm_cmpeq_ps(p[b], zero), _mm_cmplt_ps(q[b], zero)));
+        }
+        // 被拒绝的线令t0 = 2 > t1
+        lo = _mm_or_ps(_mm_and_ps(reject, _mm_set1_ps(2.0f)), _mm_andnot_ps(reject, lo));
+        _mm_storeu_ps(t0 + i, lo);
+        _mm_storeu_ps(t1 + i, hi);
+    }
+}
+#endif
+
+// 编译时已开SSE2（x86-64）时直接用向量实现，否则运行时检查CPU
+inline void clipLines8(const float *x1, const float *y1, const float *x2, const float *y2,
+                       const QRect &clip, float *t0, float *t1)
+{
+#ifdef RASTER_SSE2
+#ifndef __SSE2__
+    if (!__builtin_cpu_supports("sse2"))
+    {
+        clipLines8Scalar(x1, y1, x2, y2, clip, t0, t1);
+        return;
+    }
+#endif
+    clipLines8SSE2(x1, y1, x2, y2, clip, t0, t1);
+#else
+    clipLines8Scalar(x1, y1, x2, y2, clip, t0, t1);
+#endif
+}
+
+// 批量画线：每8条一组做裁剪（有SSE时向量化），再逐条把可见区间换算成副方向的行，
+// 只光栅化落在clip内的行。换算要用64位整数除法，逐条做。
+// Koch曲线等成千上万条短线段时，整体在画布外的线段在这里就被丢弃
+template<class Sink>
+void drawLines(Sink &sink, const QLineF *lines, int n, const QRect &clip)
+{
+    float x1[8], y1[8], x2[8], y2[8], t0[8], t1[8];
+    for (int base = 0; base < n; base += 8)
+    {
+        int m = mymin(8, n - base);
+        for (int i = 0; i < 8; i++)
+        {
+            // 不足8条时用第一条补齐，结果不使用
+            const QLineF &line = lines[base + (i < m ? i : 0)];
+            x1[i] = int(line.x1()); y1[i] = int(line.y1());
+            x2[i] = int(line.x2()); y2[i] = int(line.y2());
+        }
+        clipLines8(x1, y1, x2, y2, clip, t0, t1);
+        for (int i = 0; i < m; i++)
+        {
+            if (t0[i] > t1[i])
+                continue;
+            int ix1 = x1[i], iy1 = y1[i], ix2 = x2[i], iy2 = y2[i];
+            int dx = abs(ix2 - ix1), dy = abs(iy2 - iy1);
+            int dmaj = mymax(dx, dy), dmin = mymin(dx, dy);
+            if (dmin == 0)
+            {
+                drawLineRows(sink, ix1, iy1, ix2, iy2, 0, 0);
+                continue;
+            }
+            // 可见参数区间换算为主方向步数，多留一步余量，再换算为副方向的行
+            int kmin = mymax(int(floor(t0[i] * dmaj)) - 1, 0);
+            int kmax = mymin(int(ceil(t1[i] * dmaj)) + 1, dmaj);
+            int jbegin = int((2 * qint64(dmin) * kmin + dmaj) / (2 * qint64(dmaj)));
+            int jend = int((2 * qint64(dmin) * kmax + dmaj) / (2 * qint64(dmaj)));
+            drawLineRows(sink, ix1, iy1, ix2, iy2, jbegin, jend);
+        }
+    }
+}
+
+// 多边形扫描线填充用的边：从起始行开始，到ymax行（含）为止。
+// 每行的交点x由上端点(ax, ay)和方向(dx, dy)直接求出，不逐行累加dx/dy：
+// 顶点为整数时交点正好落在像素中心上的情形很常见，累加的误差会让它偏到下一个像素
+struct PolygonEdge
+{
+    int ymax;
+    double x;
+    double ax, ay, dx, dy;
+};
+
+// 有序边表/活性边表多边形填充，奇偶规则，可以是凹多边形。
+// 只填充像素中心落在多边形内的像素，只处理[top, bottom]内的行，按行整段输出
+template<class Sink>
+void fillPolygon(Sink &sink, const QVector<QPointF> &points, int top, int bottom)
+{
+    int n = points.size();
+    if (n < 3 || top > bottom)
+        return;
+
+    // 边表：每条非水平边按它覆盖的第一行放进对应的桶，覆盖行为 ylow <= y < yhigh
+    QVector<QVector<PolygonEdge> > table(bottom - top + 1);
+    for (int i = 0; i < n; i++)
+    {
+        QPointF a = points.at(i), b = points.at((i + 1) % n);
+        if (a.y() == b.y())
+            continue;
+        if (a.y() > b.y())
+            qSwap(a, b);
+        int ystart = int(ceil(a.y())), yend = int(ceil(b.y())) - 1;
+        if (ystart > yend || yend < top || ystart > bottom)
+            continue;
+        PolygonEdge edge;
+        edge.ax = a.x();
+        edge.ay = a.y();
+        edge.dx = b.x() - a.x();
+        edge.dy = b.y() - a.y();
+        ystart = mymax(ystart, top);
+        edge.ymax = yend;
+        table[ystart - top].append(edge);
+    }
+
+    QVector<PolygonEdge> active;
+    for (int y = top; y <= bottom; y++)
+    {
+        active += table.at(y - top);
+        for (int k = active.size() - 1; k >= 0; k--)
+        {
+            PolygonEdge &edge = active[k];
+            if (edge.ymax < y)
+                active.remove(k);
+            else
+                edge.x = edge.ax + (y - edge.ay) * edge.dx / edge.dy;
+        }
+        // 活性边上一行已基本有序，用插入排序
+        for (int k = 1; k < active.size(); k++)
+        {
+            PolygonEdge edge = active.at(k);
+            int m = k - 1;
+            while (m >= 0 && active.at(m).x > edge.x)
+            {
+                active[m + 1] = active.at(m);
+                m--;
+            }
+            active[m + 1] = edge;
+        }
+        for (int k = 0; k + 1 < active.size(); k += 2)
+        {
+            int xl = int(ceil(active.at(k).x)), xr = int(ceil(active.at(k + 1).x)) - 1;
+            if (xl <= xr)
+                sink.hline(xl, xr, y);
+        }
+    }
+}
+
+// 三角形光栅化输出的重心坐标：l1、l2为第二、第三个顶点在像素(x0, y)处的权重，
+// 第一个顶点为 1 - l1 - l2；沿x每走一个像素分别增加dl1、dl2
+struct Barycentric
+{
+    float l1, l2;
+    float dl1, dl2;
+};
+
+// 半平面（边函数）三角形光栅化。顶点取4位亚像素的定点数，边函数按像素增量计算；
+// 以8×8为块，整块在某条边外的直接跳过，整块在三条边内的不再逐像素判断。
+// 落在边上的像素按左上规则归属，共用边的相邻三角形既不重叠也不留缝。
+// 每段连续覆盖的像素调用一次 shader.span(y, x0, x1, const Barycentric &)
+template<class Shader>
+void fillTriangle(Shader &shader, const QPointF &p0, const QPointF &p1, const QPointF &p2, const QRect &clip)
+{
+    const int sub = 16, tile = 8;
+    qint64 x[3] = { qRound64(p0.x() * sub), qRound64(p1.x() * sub), qRound64(p2.x() * sub) };
+    qint64 y[3] = { qRound64(p0.y() * sub), qRound64(p1.y() * sub), qRound64(p2.y() * sub) };
+
+    // 统一成内部边函数为正的顶点顺序
+    qint64 area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (area == 0)
+        return;
+    bool swapped = area < 0;
+    if (swapped)
+    {
+        qSwap(x[1], x[2]);
+        qSwap(y[1], y[2]);
+        area = -area;
+    }
+
+    int left = int(floor(mymin(mymin(x[0], x[1]), x[2]) / double(sub)));
+    int right = int(ceil(mymax(mymax(x[0], x[1]), x[2]) / double(sub)));
+    int top = int(floor(mymin(mymin(y[0], y[1]), y[2]) / double(sub)));
+    int bottom = int(ceil(mymax(mymax(y[0], y[1]), y[2]) / double(sub)));
+    QRect box = QRect(QPoint(left, top), QPoint(right, bottom)) & clip;
+    if (box.isEmpty())
+        return;
+
+    // 边i对着顶点i，从顶点i+1指向i+2。e[i]为加上左上规则偏置后在box左上角像素的值，
+    // 向右一个像素加ex[i]，向下一个像素加ey[i]，像素在三角形内当且仅当三个值都不小于0
+    qint64 e[3], ex[3], ey[3], bias[3];
+    for (int i = 0; i < 3; i++)
+    {
+        int a = (i + 1) % 3, b = (i + 2) % 3;
+        qint64 dx = x[b] - x[a], dy = y[b] - y[a];
+        ex[i] = -dy * sub;
+        ey[i] = dx * sub;
+        bias[i] = (dy < 0 || (dy == 0 && dx > 0)) ? 0 : -1;
+        e[i] = dx * (box.top() * sub - y[a]) - dy * (box.left() * sub - x[a]) + bias[i];
+    }
+
+    float inv = 1.0f / area;
+    int i1 = swapped ? 2 : 1, i2 = swapped ? 1 : 2;
+    Barycentric bary;
+    bary.dl1 = ex[i1] * inv;
+    bary.dl2 = ex[i2] * inv;
+
+    for (int ty = box.top(); ty <= box.bottom(); ty += tile)
+    {
+        int th = mymin(tile, box.bottom() - ty + 1);
+        for (int tx = box.left(); tx <= box.right(); tx += tile)
+        {
+            int tw = mymin(tile, box.right() - tx + 1);
+
+            // 线性函数在块上的最值落在四个角上
+            qint64 c[3];
+            bool inside = true, outside = false;
+            for (int i = 0; i < 3; i++)
+            {
+                c[i] = e[i] + (tx - box.left()) * ex[i] + (ty - box.top()) * ey[i];
+                qint64 c1 = c[i] + (tw - 1) * ex[i], c2 = c[i] + (th - 1) * ey[i], c3 = c1 + (th - 1) * ey[i];
+                qint64 lo = mymin(mymin(c[i], c1), mymin(c2, c3));
+                qint64 hi = mymax(mymax(c[i], c1), mymax(c2, c3));
+                if (hi < 0)
+                    outside = true;
+                if (lo < 0)
+                    inside = false;
+            }
+            if (outside)
+                continue;
+
+            for (int j = 0; j < th; j++)
+            {
+                qint64 r[3] = { c[0] + j * ey[0], c[1] + j * ey[1], c[2] + j * ey[2] };
+                int k0 = 0, k1 = tw - 1;
+                if (!inside)
+                {
+                    // 三角形是凸的，每行的覆盖区间连续
+                    k0 = -1;
+                    for (int k = 0; k < tw; k++)
+                    {
+                        if (((r[0] + k * ex[0]) | (r[1] + k * ex[1]) | (r[2] + k * ex[2])) >= 0)
+                        {
+                            if (k0 < 0)
+                                k0 = k;
+                            k1 = k;
+                        }
+                        else if (k0 >= 0)
+                        {
+                            break;
+                        }
+                    }
+                    if (k0 < 0)
+                        continue;
+                }
+                bary.l1 = (r[i1] + k0 * ex[i1] - bias[i1]) * inv;
+                bary.l2 = (r[i2] + k0 * ex[i2] - bias[i2]) * inv;
+                shader.span(ty + j, tx + k0, tx + k1, bary);
+            }
+        }
+    }
+}
+
+// 单条直线的裁剪版本，clip外的部分不做光栅化
+template<class Sink>
+inline void drawLine(Sink &sink, const QLineF &line, const QRect &clip)
+{
+    drawLines(sink, &line, 1, clip);
+}
+
+inline QPointF rotate(int x, int y, float cosa, float sina)
+{
+    int xt = x;
+    QPointF p;
+    p.setX(x * cosa + y * sina);
+    p.setY(y * cosa - xt * sina);
+    return p;
+}
+
+// 中点画椭圆算法
+template<class Sink>
+void drawEllipse(Sink &sink, QLineF line, int rx, int ry, int ang)
+{
+    float cosa = cos(ang * PI / 180.0);
+    float sina = sin(ang * PI / 180.0);
+    int xc = line.x2(), yc = line.y2();
+    sina = (abs(sina) < 1e-3) ? 0 : sina;
+    cosa = (abs(cosa) < 1e-3) ? 0 : cosa;
+    int x = 0, y = ry;
+    QPointF p = rotate(x, y, cosa, sina);
+    int xx = p.x(), yy = p.y();
+    sink.plot(xc + xx, yc + yy);
+    p = rotate(x, -y, cosa, sina);
+    xx = p.x(), yy = p.y();
+    sink.plot(xc + xx, yc + yy);
+    p = rotate(-x, y, cosa, sina);
+    xx = p.x(), yy = p.y();
+    sink.plot(xc + xx, yc + yy);
+    p = rotate(-x, -y, cosa, sina);
+    xx = p.x(), yy = p.y();
+    sink.plot(xc + xx, yc + yy);
+
+    int rx2 = rx * rx, ry2 = ry * ry;
+    int tworx2 = 2 * rx2, twory2 = 2 * ry2;
+    int p1 = ry * ry - rx * rx * ry - rx * rx / 4;
+    int px = 0, py = tworx2 * y;
+
+    while (px < py)
+    {
+        x++;
+        px += twory2;
+        if (p1 < 0)
+        {
+            p1 += px + ry2;
+        }
+        else
+        {
+            y--;
+            py -= tworx2;
+            p1 += px - py + ry2;
+        }
+
+        p = rotate(x, y, cosa, sina);
+        xx = p.x(), yy = p.y();
+        sink.plot(xc + xx, yc + yy);
+        p = rotate(x, -y, cosa, sina);
+        xx = p.x(), yy = p.y();
+        sink.plot(xc + xx, yc + yy);
+        p = rotate(-x, y, cosa, sina);
+        xx = p.x(), yy = p.y();
+        sink.plot(xc + xx, yc + yy);
+        p = rotate(-x, -y, cosa, sina);
+        xx = p.x(), yy = p.y();
+        sink.plot(xc + xx, yc + yy);
+    }
+
+    int p2 = round(ry2 * (x + 1/2) * (x + 1/2) + rx2 * (y - 1) * (y - 1) - rx2 * ry2);
+    while (y > 0)
+    {
+        y--;
+        py -= tworx2;
+        if (p2 > 0)
+        {
+            p2 += rx2 - py;
+        }
+        else
+        {
+            x++;
+            px += twory2;
+            p2 += px - py + rx2;
+        }
+
+        p = rotate(x, y, cosa, sina);
+        xx = p.x(), yy = p.y();
+        sink.plot(xc + xx, yc + yy);
+        p = rotate(x, -y, cosa, sina);
+        xx = p.x(), yy = p.y();
+        sink.plot(xc + xx, yc + yy);
+        p = rotate(-x, y, cosa, sina);
+        xx = p.x(), yy = p.y();
+        sink.plot(xc + xx, yc + yy);
+        p = rotate(-x, -y, cosa, sina);
+        xx = p.x(), yy = p.y();
+        sink.plot(xc + xx, yc + yy);
+    }
+}
+
+// 转角ang（度）的余弦、正弦，接近0的取0
+inline void ellipseAngle(float ang, float &cosa, float &sina)
+{
+    cosa = cos(ang * PI / 180.0);
+    sina = sin(ang * PI / 180.0);
+    sina = (abs(sina) < 1e-3) ? 0 : sina;
+    cosa = (abs(cosa) < 1e-3) ? 0 : cosa;
+}
+
+// 与原种子填充相同的判定：相对圆心的坐标转到椭圆自身坐标系后取整
+inline bool inEllipse(int dx, int dy, float cosa, float sina, float ra, float rb)
+{
+    QPointF p = rotate(dx, dy, cosa, -sina);
+    int u = p.x(), v = p.y();
+    return (u * u / (ra * ra) + v * v / (rb * rb)) < 1;
+}
+
+// 以(xc, yc)为中心、长短半轴ra、rb、转角ang（度）的椭圆填充，(x1, y1)为点击点。
+// 填充满足inEllipse判定的全部像素，只处理clip内的像素。
+// 判定取整只会把坐标拉向原点，满足判定的像素都在椭圆外扩√2以内，落在半轴放大outer倍的椭圆里；
+// 离边界2以上的像素一定满足判定，它们在缩小到inner倍的椭圆里。逐行解这两个椭圆的方程，
+// 内层的一段直接写入，两侧的窄带逐点判定，连续满足的整段写入
+template<class Sink>
+void fillEllipse(Sink &sink, int x1, int y1, int xc, int yc, float ra, float rb, float ang, const QRect &clip)
+{
+    float cosa, sina;
+    ellipseAngle(ang, cosa, sina);
+    if (ra <= 0 || rb <= 0)
+        return;
+
+    // 点击点不在椭圆内时只画这一个点
+    if (!inEllipse(x1 - xc, y1 - yc, cosa, sina, ra, rb))
+    {
+        sink.plot(x1, y1);
+        return;
+    }
+
+    // 第dy行满足 A·dx² + B·dx + Ck·dy² - k² < 0 的dx在半轴放大k倍的椭圆内
+    double ra2 = ra * ra, rb2 = rb * rb;
+    double A = cosa * cosa / ra2 + sina * sina / rb2;
+    double Bk = 2 * sina * cosa * (1 / rb2 - 1 / ra2);
+    double Ck = sina * sina / ra2 + cosa * cosa / rb2;
+    double m = mymin(ra, rb);
+    double outer = 1 + 1.5 / m, inner = 1 - 2 / m;
+    int hy = int(outer * sqrt(ra2 * sina * sina + rb2 * cosa * cosa)) + 2;
+
+    int top = mymax(yc - hy, clip.top()), bottom = mymin(yc + hy, clip.bottom());
+    for (int y = top; y <= bottom; y++)
+    {
+        int dy = y - yc;
+        double B = Bk * dy;
+        double disc = B * B - 4 * A * (Ck * dy * dy - outer * outer);
+        if (disc < 0)
+            continue;
+        double sq = sqrt(disc);
+        int xl = mymax(xc + int(floor((-B - sq) / (2 * A))), clip.left());
+        int xr = mymin(xc + int(ceil((-B + sq) / (2 * A))), clip.right());
+
+        // 内层的一段[il, ir]，没有时令il在xr之后
+        int il = xr + 1, ir = xr;
+        disc = B * B - 4 * A * (Ck * dy * dy - inner * inner);
+        if (inner > 0 && disc >= 0)
+        {
+            sq = sqrt(disc);
+            il = mymax(xc + int(ceil((-B - sq) / (2 * A))), xl);
+            ir = mymin(xc + int(floor((-B + sq) / (2 * A))), xr);
+            if (il > ir)
+                il = xr + 1;
+        }
+
+        // start为上一个不满足判定的像素
+        int start = xl - 1;
+        for (int x = xl; x <= xr; x++)
+        {
+            if (x == il)
+            {
+                x = ir;
+                continue;
+            }
+            if (!inEllipse(x - xc, dy, cosa, sina, ra, rb))
+            {
+                if (x - 1 > start)
+                    sink.hline(start + 1, x - 1, y);
+                start = x;
+            }
+        }
+        if (xr > start)
+            sink.hline(start + 1, xr, y);
+    }
+}
+
+inline bool in4region(int x1, int y1, int x2, int y2)
+{
+    if (abs(x1 - x2) <= 1 && abs(y1 - y2) <= 1)
+        return true;
+    else
+        return false;
+}
+
+// bezier曲线生成
+template<class Sink>
+void bezier(Sink &sink, QVector<QPointF> *points)
+{
+    int size = points->size();
+    plotPoint(sink, points->at(0));
+    plotPoint(sink, points->at(size - 1));
+    bool flag = true;
+    for (int i = 0; i < size - 1; i++)
+    {
+        int x1 = points->at(i).x(), y1 = points->at(i).y();
+        int x2 = points->at(i + 1).x(), y2 = points->at(i + 1).y();
+        if (!in4region(x1, y1, x2, y2))
+        {
+            flag = false;
+            break;
+        }
+    }
+    if (flag)
+    {
+        for (int i = 1; i < size - 1; i++)
+            plotPoint(sink, points->at(i));
+        return;
+    }
+
+    QVector<QPointF> tmp1;
+    QVector<QPointF> tmp2;
+    QVector<QPointF> points1;
+    QVector<QPointF> points2;
+    points1.append(points->at(0));
+    points2.append(points->at(size - 1));
+
+    for (int i = 0; i < size; i++)
+    {
+        tmp2.append(points->at(i));
+        if ((i + 1) % 3 == 0 && (i + 1) < size)
+            tmp2.append((points->at(i) + points->at(i + 1)) / 2);
+    }
+    size = tmp2.size();
+    for (int i = 0; i < size - 1; i++)
+    {
+        for (int j = 0; j < tmp2.size() - 1; j++)
+        {
+            QPointF tmpP0 = tmp2.at(j);
+            QPointF tmpP1 = tmp2.at(j + 1);
+            tmp1.append((tmpP0 + tmpP1) / 2);
+        }
+        tmp2.clear();
+        for (int j = 0; j < tmp1.size(); j++)
+        {
+            tmp2.append(tmp1.at(j));
+        }
+        tmp1.clear();
+        points1.append(tmp2.at(0));
+        points2.append(tmp2.at(tmp2.size() - 1));
+
+    }
+    bezier(sink, &points1);
+    bezier(sink, &points2);
+}
+
+//B-样条
+template<class Sink>
+void bspline(Sink &sink, QVector<QPointF> *points)
+{
+    int n = points->size() - 1;
+    int xt, yt;
+    float step = 0.1 / sqrt((points->at(n).x() - points->at(0).x()) * (points->at(n).x() - points->at(0).x()) +
+                   (points->at(n).y() - points->at(0).y()) * (points->at(n).y() - points->at(0).y()));
+    for (int k = 0; k < n - 2; k += 1)
+    {
+        xt = 0; yt = 0;
+        for (float i = 0; i <= 1; i += step)
+        {
+            int x1 = points->at(k).x(), y1 = points->at(k).y();
+            int x2 = points->at(k + 1).x(), y2 = points->at(k + 1).y();
+            int x3 = points->at(k + 2).x(), y3 = points->at(k + 2).y();
+            int x4 = points->at(k + 3).x(), y4 = points->at(k + 3).y();
+            xt = ((-x1 + 3 * x2 - 3 * x3 + x4) * i * i * i +
+                    (x1 * 3 - 6 * x2 + 3 * x3) * i * i +
+                    (-x1 * 3 + 3 * x3) * i +
+                    (x1 + 4 * x2 + x3)) / 6;
+            yt = ((-y1 + 3 * y2 - 3 * y3 + y4) * i * i * i +
+                    (y1 * 3 - 6 * y2 + 3 * y3) * i * i +
+                    (-y1 * 3 + 3 * y3) * i +
+                    (y1 + 4 * y2 + y3)) / 6;
+            sink.plot(xt, yt);
+        }
+    }
+}
+
+//蕨类植物
+template<class Sink>
+void ferns(Sink &sink, QLineF line)
+{
+    int x1 = line.x1(), y1 = line.y1();
+
+    // 以位置为种子的线性同余随机数，保证同一棵蕨每次重画（缓存与局部刷新）结果一致
+    unsigned int seed = x1 * 73856093u ^ y1 * 19349663u;
+    float x0 = 0, y0 = 0;
+    for (int t = 0; t < 15550; t++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        float prob = ((seed >> 16) & 0x7fff) / 32767.0f;
+
+        float x = x0, y = y0;
+        if (prob <= 0.01)
+        {
+            x0 = 0;
+            y0 = 0.16 * y;
+        }
+        else if (prob <= 0.08)
+        {
+            x0 = (-0.15 * x + 0.28 * y);
+            y0 = (0.26 * x + 0.24 * y + 0.44);
+        }
+        else if (prob <= 0.15)
+        {
+            x0 =  (0.2 * x - 0.26 * y);
+            y0 =  (0.23 * x + 0.22 * y + 1.6);
+        }
+        else
+        {
+            x0 = (0.85 * x + 0.04 * y);
+            y0 = (-0.04 * x + 0.85 * y + 1.6);
+        }
+        sink.plot(x1 + x0 * 30, y1 + y0 * 30);
+    }
+}
+
+#endif // RASTERIZER_H
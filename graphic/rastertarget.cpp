@@ -0,0 +1,80 @@
+#include "rastertarget.h"
+#include <string.h>
+#include <float.h>
+
+RasterTarget::RasterTarget()
+    : m_bits(0)
+    , m_stride(0)
+    , m_color(0xff000000)
+    , m_opaque(true)
+    , m_penWidth(1)
+{
+}
+
+void RasterTarget::resize(int width, int height)
+{
+    if (width == m_image.width() && height == m_image.height())
+        return;
+    m_image = QImage(width, height, QImage::Format_ARGB32_Premultiplied);
+    m_depth.clear();
+    m_bits = reinterpret_cast<QRgb *>(m_image.bits());
+    m_stride = m_image.bytesPerLine() / sizeof(QRgb);
+    m_clip = m_image.rect();
+}
+
+void RasterTarget::setClipRect(const QRect &rect)
+{
+    m_clip = rect & m_image.rect();
+}
+
+void RasterTarget::clear()
+{
+    m_image.fill(0);
+    m_depth.clear();
+}
+
+float *RasterTarget::depthLine(int y)
+{
+    if (m_depth.isEmpty())
+        m_depth.fill(FLT_MAX, width() * height());
+    return m_depth.data() + y * width();
+}
+
+// 复制other中rect区域的像素和深度，两者尺寸必须相同
+void RasterTarget::copyFrom(const RasterTarget &other, const QRect &rect)
+{
+    QRect r = rect & m_image.rect();
+    if (r.isEmpty())
+        return;
+    for (int y = r.top(); y <= r.bottom(); y++)
+        memcpy(scanLine(y) + r.left(), other.m_bits + y * other.m_stride + r.left(),
+               r.width() * sizeof(QRgb));
+
+    if (other.hasDepth())
+    {
+        for (int y = r.top(); y <= r.bottom(); y++)
+            memcpy(depthLine(y) + r.left(), other.m_depth.constData() + y * width() + r.left(),
+                   r.width() * sizeof(float));
+    }
+    else if (hasDepth())
+    {
+        for (int y = r.top(); y <= r.bottom(); y++)
+        {
+            float *line = depthLine(y);
+            std::fill(line + r.left(), line + r.right() + 1, FLT_MAX);
+        }
+    }
+}
+
+void RasterTarget::setPen(const QPen &pen)
+{
+    setColor(pen.color());
+    m_penWidth = pen.width();
+}
+
+void RasterTarget::setColor(const QColor &color)
+{
+    m_color = qPremultiply(color.rgba());
+    m_opaque = qAlpha(m_color) == 255;
+    m_penWidth = 1;
+}
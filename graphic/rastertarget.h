@@ -0,0 +1,138 @@
+#ifndef RASTERTARGET_H
+#define RASTERTARGET_H
+#include <QImage>
+#include <QPen>
+#include <QColor>
+#include <QPointF>
+#include <QRect>
+#include <QVector>
+#include <algorithm>
+
+// 软件光栅目标：封装ARGB32_Premultiplied格式的QImage，
+// 各算法直接按扫描线指针写像素，最后由Painter::paint一次性贴图
+class RasterTarget
+{
+public:
+    RasterTarget();
+
+    void resize(int width, int height);
+    void clear();
+    void copyFrom(const RasterTarget &other, const QRect &rect);
+
+    int width() const { return m_image.width(); }
+    int height() const { return m_image.height(); }
+    const QImage &image() const { return m_image; }
+
+    QRgb *scanLine(int y) { return m_bits + y * m_stride; }
+
+    // 三维图元共用的深度缓冲，存规范化设备坐标的z，越小离观察者越近。
+    // 第一次用到时才分配，没有画过三维图元的像素都在无穷远处
+    float *depthLine(int y);
+    bool hasDepth() const { return !m_depth.isEmpty(); }
+
+    // 裁剪矩形，之外的像素一律不写；resize后为整幅图像
+    void setClipRect(const QRect &rect);
+    const QRect &clipRect() const { return m_clip; }
+    // 按画笔宽度外扩的裁剪矩形：线宽大于1时，中心在clip外的点也会画到clip内
+    QRect strokeClipRect() const
+    {
+        int pad = m_penWidth <= 1 ? 0 : m_penWidth;
+        return m_clip.adjusted(-pad, -pad, pad, pad);
+    }
+
+    // 画笔：颜色和宽度，与QPainter::setPen语义一致
+    void setPen(const QPen &pen);
+    void setColor(const QColor &color);
+
+    // 按当前画笔画点，宽度大于1时画以(x, y)为中心的方块
+    inline void drawPoint(int x, int y)
+    {
+        if (m_penWidth <= 1)
+        {
+            if (m_clip.contains(x, y))
+                blend(scanLine(y)[x]);
+            return;
+        }
+        hline(x, x, y);
+    }
+
+    inline void drawPoint(const QPointF &p)
+    {
+        drawPoint(qRound(p.x()), qRound(p.y()));
+    }
+
+    // 作为光栅化模板的Sink
+    inline void plot(int x, int y) { drawPoint(x, y); }
+
+    // 按当前画笔整段填充[x0, x1]×y，线宽大于1时是逐点方块的并集
+    inline void hline(int x0, int x1, int y)
+    {
+        int h = m_penWidth <= 1 ? 0 : m_penWidth / 2;
+        int w = m_penWidth <= 1 ? 1 : m_penWidth;
+        fillRect(x0 - h, y - h, x1 - h + w - 1, y - h + w - 1);
+    }
+
+    inline void vline(int x, int y0, int y1)
+    {
+        int h = m_penWidth <= 1 ? 0 : m_penWidth / 2;
+        int w = m_penWidth <= 1 ? 1 : m_penWidth;
+        fillRect(x - h, y0 - h, x - h + w - 1, y1 - h + w - 1);
+    }
+
+    // 直接写入不透明颜色，忽略画笔，用于逐像素着色
+    inline void setPixel(int x, int y, QRgb rgb)
+    {
+        if (m_clip.contains(x, y))
+            scanLine(y)[x] = rgb | 0xff000000;
+    }
+
+private:
+    // 填充闭区间矩形[x0, x1]×[y0, y1]，不透明时按行整段写入
+    inline void fillRect(int x0, int y0, int x1, int y1)
+    {
+        x0 = qMax(x0, m_clip.left());
+        y0 = qMax(y0, m_clip.top());
+        x1 = qMin(x1, m_clip.right());
+        y1 = qMin(y1, m_clip.bottom());
+        if (x0 > x1)
+            return;
+        for (int j = y0; j <= y1; j++)
+        {
+            QRgb *line = scanLine(j);
+            if (m_opaque)
+            {
+                std::fill(line + x0, line + x1 + 1, m_color);
+            }
+            else
+            {
+                for (int i = x0; i <= x1; i++)
+                    blend(line[i]);
+            }
+        }
+    }
+
+    inline void blend(QRgb &dst) const
+    {
+        if (m_opaque)
+        {
+            dst = m_color;
+            return;
+        }
+        uint ia = 255 - qAlpha(m_color);
+        dst = qRgba(qRed(m_color) + qRed(dst) * ia / 255,
+                    qGreen(m_color) + qGreen(dst) * ia / 255,
+                    qBlue(m_color) + qBlue(dst) * ia / 255,
+                    qAlpha(m_color) + qAlpha(dst) * ia / 255);
+    }
+
+    QImage m_image;
+    QVector<float> m_depth;
+    QRect m_clip;
+    QRgb *m_bits; // 缓存的像素指针，避免每次访问都经过QImage::scanLine的detach检查
+    int m_stride;
+    QRgb m_color; // 预乘后的画笔颜色
+    bool m_opaque;
+    int m_penWidth;
+};
+
+#endif // RASTERTARGET_H
@@ -0,0 +1,505 @@
+#include "shadekernel.h"
+
+// x86上用GCC的target属性为各指令集单独编译内核，运行时按CPU选择，
+// 整个程序仍按默认的指令集编译。64位MinGW不能为32字节对齐的栈变量调整栈指针，
+// 在那里只用SSE2
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define SHADE_SSE2
+#if !(defined(_WIN64) && !defined(__clang__))
+#define SHADE_AVX
+#endif
+#include <immintrin.h>
+#endif
+
+// 单位法向量(nx, ny, nz)与光源的光线、半角向量夹角的余弦。点光源的光线从球面上的点
+// （在单位球上就是法向量本身）指向光源，半角向量逐点由光线和视线求出
+static inline void lightCosines(const ShadeParams &p, const ShadeLight &l, float nx, float ny, float nz,
+                                float &cosfi, float &cosnh)
+{
+    if (!l.point)
+    {
+        cosfi = nx * l.x + ny * l.y + nz * l.z;
+        cosnh = nx * l.hx + ny * l.hy + nz * l.hz;
+    }
+    else
+    {
+        float lx = l.x - nx, ly = l.y - ny, lz = l.z - nz;
+        float len = sqrtf(lx * lx + ly * ly + lz * lz);
+        len = len > 1e-6f ? len : 1e-6f;
+        lx /= len; ly /= len; lz /= len;
+        cosfi = nx * lx + ny * ly + nz * lz;
+        float hx = lx + p.vx, hy = ly + p.vy, hz = lz + p.vz;
+        float hl = sqrtf(hx * hx + hy * hy + hz * hz);
+        hl = hl > 1e-6f ? hl : 1e-6f;
+        cosnh = (nx * hx + ny * hy + nz * hz) / hl;
+    }
+    if (l.clamp)
+    {
+        cosfi = cosfi > 0 ? cosfi : 0;
+        cosnh = cosnh > 0 ? cosnh : 0;
+    }
+}
+
+static void accumulateScalar(const ShadeParams &p, const ShadeLight &l,
+                             const float *nx, const float *ny, const float *nz, int count,
+                             float *ir, float *ig, float *ib)
+{
+    for (int i = 0; i < count; i++)
+    {
+        float cosfi, cosnh;
+        lightCosines(p, l, nx[i], ny[i], nz[i], cosfi, cosnh);
+        float s = 1;
+        for (int e = 0; e < p.shininess; e++)
+            s *= cosnh;
+        float f = p.diffuse * cosfi + p.specular * s;
+        ir[i] += l.r * f;
+        ig[i] += l.g * f;
+        ib[i] += l.b * f;
+    }
+}
+
+static void resolveScalar(const ShadeParams &p, const float *ir, const float *ig, const float *ib,
+                          const QRgb *texels, int count, QRgb *out)
+{
+    float range = p.Imax - p.Imin;
+    float scale[3] = { p.r / 255, p.g / 255, p.b / 255 };
+    for (int i = 0; i < count; i++)
+    {
+        float I[3] = { (ir[i] - p.Imin) / range, (ig[i] - p.Imin) / range, (ib[i] - p.Imin) / range };
+        out[i] = shadeColor(p, I, texels ? texels + i : 0, scale);
+    }
+}
+
+const ShadeKernel &shadeKernelScalar()
+{
+    static const ShadeKernel kernel = { accumulateScalar, resolveScalar };
+    return kernel;
+}
+
+// 最多一批像素上各通道未归一化的亮度：环境光加上所有光源
+static const int lightBatch = 256;
+
+static void accumulateLights(const ShadeKernel &kernel, const ShadeParams &p,
+                             const float *nx, const float *ny, const float *nz, int count,
+                             float *ir, float *ig, float *ib)
+{
+    for (int i = 0; i < count; i++)
+        ir[i] = ig[i] = ib[i] = p.ambient;
+    for (int k = 0; k < p.lightCount; k++)
+        kernel.accumulate(p, p.lights[k], nx, ny, nz, count, ir, ig, ib);
+}
+
+void shadeLights(const ShadeKernel &kernel, const ShadeParams &p,
+                 const float *nx, const float *ny, const float *nz,
+                 const QRgb *texels, int count, QRgb *out)
+{
+    float ir[lightBatch], ig[lightBatch], ib[lightBatch];
+    for (int first = 0; first < count; first += lightBatch)
+    {
+        int n = qMin(lightBatch, count - first);
+        accumulateLights(kernel, p, nx + first, ny + first, nz + first, n, ir, ig, ib);
+        kernel.resolve(p, ir, ig, ib, texels ? texels + first : 0, n, out + first);
+    }
+}
+
+void shadePixelsScalar(const ShadeParams &p, const float *nx, const float *ny, const float *nz,
+                       const QRgb *texels, int count, QRgb *out)
+{
+    shadeLights(shadeKernelScalar(), p, nx, ny, nz, texels, count, out);
+}
+
+void shadePixelsTable(const ShadeParams &p, const float *nx, const float *ny, const float *nz,
+                      const QRgb *texels, int count, QRgb *out)
+{
+    const PhongTable &table = *p.table;
+    float scale[3] = { p.r / 255, p.g / 255, p.b / 255 };
+    for (int i = 0; i < count; i++)
+    {
+        float I[3];
+        table.lookup(nx[i], ny[i], nz[i], I);
+        out[i] = shadeColor(p, I, texels ? texels + i : 0, scale);
+    }
+}
+
+void shadeIntensities(const ShadeParams &p, const float *nx, const float *ny, const float *nz,
+                      int count, float *out)
+{
+    const ShadeKernel &kernel = shadeKernel();
+    float range = p.Imax - p.Imin;
+    float ir[lightBatch], ig[lightBatch], ib[lightBatch];
+    for (int first = 0; first < count; first += lightBatch)
+    {
+        int n = qMin(lightBatch, count - first);
+        accumulateLights(kernel, p, nx + first, ny + first, nz + first, n, ir, ig, ib);
+        float *I = out + first * 3;
+        for (int i = 0; i < n; i++, I += 3)
+        {
+            I[0] = (ir[i] - p.Imin) / range;
+            I[1] = (ig[i] - p.Imin) / range;
+            I[2] = (ib[i] - p.Imin) / range;
+        }
+    }
+}
+
+// 一个光源下单位圆上θ处的亮度，不含环境光和光强，c、s为半角向量在(L, e)基下的坐标。
+// clamp时背光一侧的余弦按0计，与accumulateScalar相同
+static inline double phongOnCircle(const ShadeParams &p, bool clamp, double c, double s, double t)
+{
+    double a = cos(t), cosnh = c * a + s * sin(t);
+    if (clamp)
+    {
+        a = qMax(a, 0.0);
+        cosnh = qMax(cosnh, 0.0);
+    }
+    double e = 1;
+    for (int k = 0; k < p.shininess; k++)
+        e *= cosnh;
+    return p.diffuse * a + p.specular * e;
+}
+
+// 黄金分割法求sign·f在[t0, t1]上的最大值，返回对应的f
+static double phongRefine(const ShadeParams &p, bool clamp, double c, double s,
+                          double t0, double t1, double sign)
+{
+    const double r = 0.6180339887;
+    double x1 = t1 - r * (t1 - t0), x2 = t0 + r * (t1 - t0);
+    double f1 = sign * phongOnCircle(p, clamp, c, s, x1), f2 = sign * phongOnCircle(p, clamp, c, s, x2);
+    for (int i = 0; i < 40; i++)
+    {
+        if (f1 < f2)
+        {
+            t0 = x1;
+            x1 = x2;
+            f1 = f2;
+            x2 = t0 + r * (t1 - t0);
+            f2 = sign * phongOnCircle(p, clamp, c, s, x2);
+        }
+        else
+        {
+            t1 = x2;
+            x2 = x1;
+            f2 = f1;
+            x1 = t1 - r * (t1 - t0);
+            f1 = sign * phongOnCircle(p, clamp, c, s, x1);
+        }
+    }
+    return phongOnCircle(p, clamp, c, s, (t0 + t1) / 2);
+}
+
+// 一个光源在单位球面上的亮度（不含环境光和光强）的最小、最大值。
+// 亮度只取决于法向量在光线L、半角向量H所张平面上的投影，投影落在单位圆盘内。
+// 取平面上的正交基(L, e)，H = c·L + s·e，投影为(a, b)时f = diffuse·a + specular·(c·a + s·b)^n。
+// 一般情形下梯度在圆盘内处处不为零；L与H平行或没有漫反射时f只是一个方向上坐标的函数，
+// 单位圆上已能取遍它的所有值。所以最值都在单位圆上，化为θ的一元函数。
+// 指数为n时驻点方程没有一般的解析解，这里是数值求解：等距取样找到最值附近，
+// 再用黄金分割细化。点光源按球心处的方向近似
+static void phongLightRange(const ShadeParams &p, const ShadeLight &l, double &fmin, double &fmax)
+{
+    double lx = l.x, ly = l.y, lz = l.z;
+    if (l.point)
+    {
+        double len = sqrt(lx * lx + ly * ly + lz * lz);
+        lx /= len; ly /= len; lz /= len;
+    }
+    double c = lx * l.hx + ly * l.hy + lz * l.hz;
+    double s = sqrt(qMax(1 - c * c, 0.0));
+    const int samples = 64;
+    const double step = 2 * 3.14159265358979 / samples;
+    int imin = 0, imax = 0;
+    fmin = phongOnCircle(p, l.clamp, c, s, 0);
+    fmax = fmin;
+    for (int i = 1; i < samples; i++)
+    {
+        double f = phongOnCircle(p, l.clamp, c, s, i * step);
+        if (f < fmin)
+        {
+            fmin = f;
+            imin = i;
+        }
+        if (f > fmax)
+        {
+            fmax = f;
+            imax = i;
+        }
+    }
+    fmin = qMin(fmin, phongRefine(p, l.clamp, c, s, (imin - 1) * step, (imin + 1) * step, -1));
+    fmax = qMax(fmax, phongRefine(p, l.clamp, c, s, (imax - 1) * step, (imax + 1) * step, 1));
+}
+
+// 主光源的亮度按它的平均光强w取最值。其余光源背光一侧不计亮度，不会让最小值更小；
+// 最大值逐通道累加各光源的最大值，取最亮的通道，所有光源同时最亮时也不会截断。
+// 方向光的最大值在单位圆上求；点光源的方向逐像素变化，按余弦都为1估计上界。
+// 没有光源或主光源全黑时最小值为0，只有环境光的部分按它与最大值的比例变暗
+void phongRange(ShadeParams &p)
+{
+    double extra[3] = { 0, 0, 0 };
+    for (int k = 1; k < p.lightCount; k++)
+    {
+        const ShadeLight &l = p.lights[k];
+        double fmin, fmax = p.diffuse + p.specular;
+        if (!l.point)
+            phongLightRange(p, l, fmin, fmax);
+        extra[0] += l.r * fmax;
+        extra[1] += l.g * fmax;
+        extra[2] += l.b * fmax;
+    }
+    double more = qMax(extra[0], qMax(extra[1], extra[2]));
+
+    double w = p.lightCount > 0 ? (p.lights[0].r + p.lights[0].g + p.lights[0].b) / 3.0 : 0;
+    if (w <= 0)
+    {
+        double Imax = p.ambient + more;
+        p.Imin = 0;
+        p.Imax = Imax > 1 ? Imax : 1;
+        return;
+    }
+
+    double fmin, fmax;
+    phongLightRange(p, p.lights[0], fmin, fmax);
+    double Imin = p.ambient + w * fmin;
+    double Imax = p.ambient + w * fmax + more;
+    p.Imin = Imin < 1e-3 ? 0 : Imin;
+    p.Imax = Imax;
+    // 没有漫反射、镜面反射也不随方向变化（系数或指数为零）时亮度处处相同，
+    // 区间退化，与没有光源时一样从0开始归一化
+    if (p.Imax - p.Imin < 1e-6f)
+    {
+        p.Imin = 0;
+        p.Imax = Imax > 1 ? Imax : 1;
+    }
+}
+
+static bool sameLight(const ShadeLight &a, const ShadeLight &b)
+{
+    return a.point == b.point && a.clamp == b.clamp
+            && a.x == b.x && a.y == b.y && a.z == b.z
+            && a.hx == b.hx && a.hy == b.hy && a.hz == b.hz
+            && a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+static bool sameLighting(const ShadeParams &a, const ShadeParams &b)
+{
+    if (a.lightCount != b.lightCount)
+        return false;
+    for (int k = 0; k < a.lightCount; k++)
+    {
+        if (!sameLight(a.lights[k], b.lights[k]))
+            return false;
+    }
+    return a.vx == b.vx && a.vy == b.vy && a.vz == b.vz
+            && a.ambient == b.ambient && a.diffuse == b.diffuse && a.specular == b.specular
+            && a.shininess == b.shininess && a.Imin == b.Imin && a.Imax == b.Imax;
+}
+
+// 材质或光源不同的球体交替出现时每次都要重建，所有球体光照相同时表才能一直共用
+void PhongTable::update(const ShadeParams &p, int n)
+{
+    if (size == n && sameLighting(key, p))
+        return;
+    size = n;
+    key = p;
+    keyLights.resize(p.lightCount);
+    for (int k = 0; k < p.lightCount; k++)
+        keyLights[k] = p.lights[k];
+    key.lights = keyLights.constData();
+    key.table = 0;
+    values.resize(n * n * 3);
+    QVector<float> row(n * 3);
+    float *xs = row.data(), *ys = xs + n, *zs = ys + n;
+    for (int y = 0; y < n; y++)
+    {
+        for (int x = 0; x < n; x++)
+        {
+            // 格点展开回单位法向量
+            float u = 2.0f * x / (n - 1) - 1, v = 2.0f * y / (n - 1) - 1;
+            float nx = u, ny = v, nz = 1 - fabs(u) - fabs(v);
+            if (nz < 0)
+            {
+                nx = (1 - fabs(v)) * (u < 0 ? -1 : 1);
+                ny = (1 - fabs(u)) * (v < 0 ? -1 : 1);
+            }
+            float len = sqrt(nx * nx + ny * ny + nz * nz);
+            xs[x] = nx / len;
+            ys[x] = ny / len;
+            zs[x] = nz / len;
+        }
+        shadeIntensities(key, xs, ys, zs, n, values.data() + y * n * 3);
+    }
+}
+
+#ifdef SHADE_SSE2
+// 每种指令集的向量运算，各自包含一次shadesimd.h得到accumulate和resolve
+namespace sse2
+{
+#define SHADE_TARGET __attribute__((target("sse2")))
+typedef __m128 F;
+typedef __m128i I;
+static const int width = 4;
+
+SHADE_TARGET static inline F set1(float a) { return _mm_set1_ps(a); }
+SHADE_TARGET static inline F load(const float *a) { return _mm_loadu_ps(a); }
+SHADE_TARGET static inline void store(float *a, F x) { _mm_storeu_ps(a, x); }
+SHADE_TARGET static inline F add(F x, F y) { return _mm_add_ps(x, y); }
+SHADE_TARGET static inline F sub(F x, F y) { return _mm_sub_ps(x, y); }
+SHADE_TARGET static inline F mul(F x, F y) { return _mm_mul_ps(x, y); }
+SHADE_TARGET static inline F div(F x, F y) { return _mm_div_ps(x, y); }
+SHADE_TARGET static inline F max(F x, F y) { return _mm_max_ps(x, y); }
+SHADE_TARGET static inline F min(F x, F y) { return _mm_min_ps(x, y); }
+SHADE_TARGET static inline F sqrt(F x) { return _mm_sqrt_ps(x); }
+
+SHADE_TARGET static inline I loadColors(const QRgb *a)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+}
+
+SHADE_TARGET static inline void unpackColors(I c, F &r, F &g, F &b)
+{
+    const I mask = _mm_set1_epi32(0xff);
+    r = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c, 16), mask));
+    g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c, 8), mask));
+    b = _mm_cvtepi32_ps(_mm_and_si128(c, mask));
+}
+
+// 各通道已截断到[0, 255]，拼成不透明的颜色
+SHADE_TARGET static inline void storeColors(QRgb *a, F r, F g, F b)
+{
+    I c = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_cvttps_epi32(r), 16),
+                                    _mm_slli_epi32(_mm_cvttps_epi32(g), 8)), _mm_cvttps_epi32(b));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(a), _mm_or_si128(c, _mm_set1_epi32(0xff000000)));
+}
+
+#include "shadesimd.h"
+#undef SHADE_TARGET
+}
+#endif
+
+#ifdef SHADE_AVX
+namespace avx2
+{
+#define SHADE_TARGET __attribute__((target("avx2")))
+typedef __m256 F;
+typedef __m256i I;
+static const int width = 8;
+
+SHADE_TARGET static inline F set1(float a) { return _mm256_set1_ps(a); }
+SHADE_TARGET static inline F load(const float *a) { return _mm256_loadu_ps(a); }
+SHADE_TARGET static inline void store(float *a, F x) { _mm256_storeu_ps(a, x); }
+SHADE_TARGET static inline F add(F x, F y) { return _mm256_add_ps(x, y); }
+SHADE_TARGET static inline F sub(F x, F y) { return _mm256_sub_ps(x, y); }
+SHADE_TARGET static inline F mul(F x, F y) { return _mm256_mul_ps(x, y); }
+SHADE_TARGET static inline F div(F x, F y) { return _mm256_div_ps(x, y); }
+SHADE_TARGET static inline F max(F x, F y) { return _mm256_max_ps(x, y); }
+SHADE_TARGET static inline F min(F x, F y) { return _mm256_min_ps(x, y); }
+SHADE_TARGET static inline F sqrt(F x) { return _mm256_sqrt_ps(x); }
+
+SHADE_TARGET static inline I loadColors(const QRgb *a)
+{
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a));
+}
+
+SHADE_TARGET static inline void unpackColors(I c, F &r, F &g, F &b)
+{
+    const I mask = _mm256_set1_epi32(0xff);
+    r = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(c, 16), mask));
+    g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(c, 8), mask));
+    b = _mm256_cvtepi32_ps(_mm256_and_si256(c, mask));
+}
+
+SHADE_TARGET static inline void storeColors(QRgb *a, F r, F g, F b)
+{
+    I c = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(_mm256_cvttps_epi32(r), 16),
+                                          _mm256_slli_epi32(_mm256_cvttps_epi32(g), 8)),
+                          _mm256_cvttps_epi32(b));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(a), _mm256_or_si256(c, _mm256_set1_epi32(0xff000000)));
+}
+
+#include "shadesimd.h"
+#undef SHADE_TARGET
+}
+
+// GCC展开avx512fintrin.h中的内联函数时会误报未初始化的变量
+#if !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+namespace avx512
+{
+#define SHADE_TARGET __attribute__((target("avx512f")))
+typedef __m512 F;
+typedef __m512i I;
+static const int width = 16;
+
+SHADE_TARGET static inline F set1(float a) { return _mm512_set1_ps(a); }
+SHADE_TARGET static inline F load(const float *a) { return _mm512_loadu_ps(a); }
+SHADE_TARGET static inline void store(float *a, F x) { _mm512_storeu_ps(a, x); }
+SHADE_TARGET static inline F add(F x, F y) { return _mm512_add_ps(x, y); }
+SHADE_TARGET static inline F sub(F x, F y) { return _mm512_sub_ps(x, y); }
+SHADE_TARGET static inline F mul(F x, F y) { return _mm512_mul_ps(x, y); }
+SHADE_TARGET static inline F div(F x, F y) { return _mm512_div_ps(x, y); }
+SHADE_TARGET static inline F max(F x, F y) { return _mm512_max_ps(x, y); }
+SHADE_TARGET static inline F min(F x, F y) { return _mm512_min_ps(x, y); }
+SHADE_TARGET static inline F sqrt(F x) { return _mm512_sqrt_ps(x); }
+
+SHADE_TARGET static inline I loadColors(const QRgb *a) { return _mm512_loadu_si512(a); }
+
+SHADE_TARGET static inline void unpackColors(I c, F &r, F &g, F &b)
+{
+    const I mask = _mm512_set1_epi32(0xff);
+    r = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srli_epi32(c, 16), mask));
+    g = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srli_epi32(c, 8), mask));
+    b = _mm512_cvtepi32_ps(_mm512_and_si512(c, mask));
+}
+
+SHADE_TARGET static inline void storeColors(QRgb *a, F r, F g, F b)
+{
+    I c = _mm512_or_si512(_mm512_or_si512(_mm512_slli_epi32(_mm512_cvttps_epi32(r), 16),
+                                          _mm512_slli_epi32(_mm512_cvttps_epi32(g), 8)),
+                          _mm512_cvttps_epi32(b));
+    _mm512_storeu_si512(a, _mm512_or_si512(c, _mm512_set1_epi32(0xff000000)));
+}
+
+#include "shadesimd.h"
+#undef SHADE_TARGET
+}
+#if !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+const ShadeKernel *shadeKernelFor(ShadeIsa isa)
+{
+    if (isa == ShadeScalar)
+        return &shadeKernelScalar();
+#ifdef SHADE_SSE2
+    __builtin_cpu_init();
+    static const ShadeKernel sse2 = { sse2::accumulate, sse2::resolve };
+    if (isa == ShadeSSE2 && __builtin_cpu_supports("sse2"))
+        return &sse2;
+#ifdef SHADE_AVX
+    static const ShadeKernel avx2 = { avx2::accumulate, avx2::resolve };
+    static const ShadeKernel avx512 = { avx512::accumulate, avx512::resolve };
+    if (isa == ShadeAVX2 && __builtin_cpu_supports("avx2"))
+        return &avx2;
+    if (isa == ShadeAVX512 && __builtin_cpu_supports("avx512f"))
+        return &avx512;
+#endif
+#endif
+    return 0;
+}
+
+static const ShadeKernel &selectShadeKernel()
+{
+    const ShadeIsa order[] = { ShadeAVX512, ShadeAVX2, ShadeSSE2 };
+    for (int i = 0; i < 3; i++)
+    {
+        if (const ShadeKernel *kernel = shadeKernelFor(order[i]))
+            return *kernel;
+    }
+    return shadeKernelScalar();
+}
+
+const ShadeKernel &shadeKernel()
+{
+    static const ShadeKernel &kernel = selectShadeKernel();
+    return kernel;
+}
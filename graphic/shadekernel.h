@@ -0,0 +1,156 @@
+#ifndef SHADEKERNEL_H
+#define SHADEKERNEL_H
+#include <QColor>
+#include <QVector>
+#include <math.h>
+
+struct PhongTable;
+
+// 一个光源在球面自身坐标中的参数，对一个图元的所有像素都不变
+struct ShadeLight
+{
+    bool point; // 点光源时(x, y, z)为相对球心的位置，以半径为单位；否则为指向光源的单位向量
+    bool clamp; // 背光的一侧不计这个光源的亮度，见sphereShadeLights
+    float x, y, z;
+    float hx, hy, hz; // 光线与视线的单位半角向量，点光源按球心处的光线方向
+    float r, g, b; // 各通道的光强
+};
+
+// Blinn-Phong着色内核的参数，对一个图元的所有像素都不变，每帧只算一次
+struct ShadeParams
+{
+    const ShadeLight *lights;
+    int lightCount;
+    float vx, vy, vz; // 指向观察者的单位向量，点光源逐像素求半角向量时用
+    float ambient; // 环境光强度乘以环境光反射系数
+    float diffuse, specular; // 漫反射、镜面反射系数
+    int shininess; // 镜面反射指数
+    float Imin, Imax; // 亮度归一化区间
+    float r, g, b; // 物体颜色
+    const PhongTable *table; // 非空时按查找表取亮度，见shadePixelsTable
+};
+
+// 由材质和光源数值求出单位球面上亮度的最大、最小值，写进p.Imin和p.Imax，各通道都按这个区间归一化。
+// 第一个光源（主光源）的最值在单位圆上搜索，其余光源累加各自的最大值，叠加后也不会超出。
+// 亮度处处相同时区间从0开始，保证Imax > Imin
+void phongRange(ShadeParams &p);
+
+// 光照查找表：光源和视线不变时亮度只取决于法向量。法向量按八面体映射展开到
+// [-1, 1]×[-1, 1]的正方形上，表中存size×size个格点上归一化后的三个通道的亮度，查表时双线性插值
+struct PhongTable
+{
+    PhongTable() : size(0) {}
+
+    // 推荐的边长，与逐像素直接计算的颜色最多差一级；边长为16时可差到十级以上
+    static const int defaultSize = 128;
+
+    // 光照参数或边长与当前的表不同时才重建
+    void update(const ShadeParams &p, int size);
+
+    inline void lookup(float nx, float ny, float nz, float *I) const
+    {
+        float l = fabs(nx) + fabs(ny) + fabs(nz);
+        float u = nx / l, v = ny / l;
+        if (nz < 0)
+        {
+            // 下半球沿对角线翻折到正方形的四个角
+            float tu = (1 - fabs(v)) * (u < 0 ? -1 : 1);
+            v = (1 - fabs(u)) * (v < 0 ? -1 : 1);
+            u = tu;
+        }
+        float fx = (u + 1) * 0.5f * (size - 1), fy = (v + 1) * 0.5f * (size - 1);
+        int x = qMin(int(fx), size - 2), y = qMin(int(fy), size - 2);
+        float ax = fx - x, ay = fy - y;
+        const float *cell = values.constData() + (y * size + x) * 3;
+        const float *below = cell + size * 3;
+        for (int k = 0; k < 3; k++)
+            I[k] = (cell[k] * (1 - ax) + cell[k + 3] * ax) * (1 - ay)
+                    + (below[k] * (1 - ax) + below[k + 3] * ax) * ay;
+    }
+
+    int size;
+    ShadeParams key; // 建表时的光照参数，lights指向keyLights
+    QVector<ShadeLight> keyLights;
+    QVector<float> values;
+};
+
+// 一种指令集的光照内核，按光源分两步批量计算count个像素，各量都按分量分开连续存放：
+// accumulate把一个光源的漫反射和镜面反射加到各通道未归一化的亮度ir、ig、ib上；
+// resolve把累加好的亮度归一化，乘上物体颜色（texels非空时先按纹素调制），写出不透明的像素颜色
+struct ShadeKernel
+{
+    void (*accumulate)(const ShadeParams &p, const ShadeLight &light,
+                       const float *nx, const float *ny, const float *nz, int count,
+                       float *ir, float *ig, float *ib);
+    void (*resolve)(const ShadeParams &p, const float *ir, const float *ig, const float *ib,
+                    const QRgb *texels, int count, QRgb *out);
+};
+
+// 对count个像素计算光照：法向量为单位向量，按分量分开连续存放；texels非空时
+// 物体颜色逐像素乘上对应的纹素。结果写进out
+typedef void (*ShadeFunction)(const ShadeParams &p, const float *nx, const float *ny, const float *nz,
+                              const QRgb *texels, int count, QRgb *out);
+
+// 归一化亮度为I（三个通道）的像素颜色，texel非空时物体颜色先按纹素调制。
+// scale为物体颜色除以255，与向量化实现中的运算次序相同
+inline QRgb shadeColor(const ShadeParams &p, const float *I, const QRgb *texel, const float *scale)
+{
+    float c[3] = { p.r, p.g, p.b };
+    if (texel)
+    {
+        c[0] = qRed(*texel) * scale[0];
+        c[1] = qGreen(*texel) * scale[1];
+        c[2] = qBlue(*texel) * scale[2];
+    }
+    for (int k = 0; k < 3; k++)
+    {
+        c[k] *= I[k];
+        c[k] = c[k] > 255 ? 255 : c[k];
+        c[k] = c[k] < 0 ? 0 : c[k];
+    }
+    return qRgb(int(c[0]), int(c[1]), int(c[2]));
+}
+
+// 只求count个单位法向量处归一化的亮度，每个法向量三个通道依次写进out，用于逐顶点和逐面的着色
+void shadeIntensities(const ShadeParams &p, const float *nx, const float *ny, const float *nz,
+                      int count, float *out);
+
+// 用kernel计算光照：每批像素先把亮度置为环境光，逐个光源累加，最后一次写出颜色。
+// 光源的循环在像素的循环之外，每个光源的参数在一批像素上不变
+void shadeLights(const ShadeKernel &kernel, const ShadeParams &p,
+                 const float *nx, const float *ny, const float *nz,
+                 const QRgb *texels, int count, QRgb *out);
+
+// 逐像素的标量实现。各指令集的实现按与它相同的次序运算，编译时须关闭乘加合并
+// (-ffp-contract=off)；标量部分在x87上按扩展精度运算时，个别像素仍可能差一级
+const ShadeKernel &shadeKernelScalar();
+
+void shadePixelsScalar(const ShadeParams &p, const float *nx, const float *ny, const float *nz,
+                       const QRgb *texels, int count, QRgb *out);
+
+// 按查找表取亮度的标量实现，p.table不能为空。查表省去了点积、乘方和光源的循环，
+// 但每个像素要做一次不规则的读取，在有SIMD的机器上光源少时不一定比直接计算快
+void shadePixelsTable(const ShadeParams &p, const float *nx, const float *ny, const float *nz,
+                      const QRgb *texels, int count, QRgb *out);
+
+enum ShadeIsa
+{
+    ShadeScalar,
+    ShadeSSE2,
+    ShadeAVX2,
+    ShadeAVX512
+};
+
+// 指定指令集的实现，没有编译进来或CPU不支持时返回0
+const ShadeKernel *shadeKernelFor(ShadeIsa isa);
+
+// 按运行时CPU支持的指令集选出的最快实现：AVX-512一次16个像素，AVX2一次8个，SSE2一次4个
+const ShadeKernel &shadeKernel();
+
+inline void shadePixels(const ShadeParams &p, const float *nx, const float *ny, const float *nz,
+                        const QRgb *texels, int count, QRgb *out)
+{
+    shadeLights(shadeKernel(), p, nx, ny, nz, texels, count, out);
+}
+
+#endif // SHADEKERNEL_H
@@ -0,0 +1,91 @@
+// 光照内核的向量化实现，shadekernel.cpp在每种指令集的命名空间里各包含一次，没有include保护。
+// 包含前要定义SHADE_TARGET（该指令集的target属性），以及向量类型F、I，每个向量的像素数width，
+// 和按F运算的set1、load、store、add、sub、mul、div、max、min、sqrt，按I运算的loadColors、
+// unpackColors、storeColors。运算次序与accumulateScalar、resolveScalar相同，
+// 末尾不足一个向量的像素交给它们
+
+SHADE_TARGET
+static inline F dot(F x, F y, F z, F a, F b, F c)
+{
+    return add(add(mul(x, a), mul(y, b)), mul(z, c));
+}
+
+SHADE_TARGET
+static void accumulate(const ShadeParams &p, const ShadeLight &l,
+                       const float *nx, const float *ny, const float *nz, int count,
+                       float *ir, float *ig, float *ib)
+{
+    const F lx = set1(l.x), ly = set1(l.y), lz = set1(l.z);
+    const F hx = set1(l.hx), hy = set1(l.hy), hz = set1(l.hz);
+    const F vx = set1(p.vx), vy = set1(p.vy), vz = set1(p.vz);
+    const F diffuse = set1(p.diffuse), specular = set1(p.specular);
+    const F r = set1(l.r), g = set1(l.g), b = set1(l.b);
+    const F zero = set1(0), one = set1(1), eps = set1(1e-6f);
+
+    int i = 0;
+    for (; i + width <= count; i += width)
+    {
+        F x = load(nx + i), y = load(ny + i), z = load(nz + i);
+        F cosfi, cosnh;
+        if (!l.point)
+        {
+            cosfi = dot(x, y, z, lx, ly, lz);
+            cosnh = dot(x, y, z, hx, hy, hz);
+        }
+        else
+        {
+            F dx = sub(lx, x), dy = sub(ly, y), dz = sub(lz, z);
+            F len = max(sqrt(dot(dx, dy, dz, dx, dy, dz)), eps);
+            dx = div(dx, len);
+            dy = div(dy, len);
+            dz = div(dz, len);
+            cosfi = dot(x, y, z, dx, dy, dz);
+            F ex = add(dx, vx), ey = add(dy, vy), ez = add(dz, vz);
+            F hl = max(sqrt(dot(ex, ey, ez, ex, ey, ez)), eps);
+            cosnh = div(dot(x, y, z, ex, ey, ez), hl);
+        }
+        if (l.clamp)
+        {
+            cosfi = max(cosfi, zero);
+            cosnh = max(cosnh, zero);
+        }
+        F s = one;
+        for (int e = 0; e < p.shininess; e++)
+            s = mul(s, cosnh);
+        F f = add(mul(diffuse, cosfi), mul(specular, s));
+        store(ir + i, add(load(ir + i), mul(r, f)));
+        store(ig + i, add(load(ig + i), mul(g, f)));
+        store(ib + i, add(load(ib + i), mul(b, f)));
+    }
+    accumulateScalar(p, l, nx + i, ny + i, nz + i, count - i, ir + i, ig + i, ib + i);
+}
+
+SHADE_TARGET
+static void resolve(const ShadeParams &p, const float *ir, const float *ig, const float *ib,
+                    const QRgb *texels, int count, QRgb *out)
+{
+    const F Imin = set1(p.Imin), range = set1(p.Imax - p.Imin);
+    const F r = set1(p.r), g = set1(p.g), b = set1(p.b);
+    const F rs = set1(p.r / 255), gs = set1(p.g / 255), bs = set1(p.b / 255);
+    const F zero = set1(0), full = set1(255);
+
+    int i = 0;
+    for (; i + width <= count; i += width)
+    {
+        F Ir = div(sub(load(ir + i), Imin), range);
+        F Ig = div(sub(load(ig + i), Imin), range);
+        F Ib = div(sub(load(ib + i), Imin), range);
+
+        F cr = r, cg = g, cb = b;
+        if (texels)
+        {
+            unpackColors(loadColors(texels + i), cr, cg, cb);
+            cr = mul(cr, rs);
+            cg = mul(cg, gs);
+            cb = mul(cb, bs);
+        }
+        storeColors(out + i, max(min(mul(cr, Ir), full), zero),
+                    max(min(mul(cg, Ig), full), zero), max(min(mul(cb, Ib), full), zero));
+    }
+    resolveScalar(p, ir + i, ig + i, ib + i, texels ? texels + i : 0, count - i, out + i);
+}
@@ -0,0 +1,74 @@
+#include "spheremesh.h"
+#include <math.h>
+
+#ifndef PI
+#define PI 3.1415926
+#endif
+
+void SphereMesh::build(int steps)
+{
+    level = steps;
+    vertices.clear();
+    indices.clear();
+
+    // u为纬度，从南极到北极只扫半圈共steps段；v为经度，一周2*steps段。
+    // 每圈columns + 1个顶点按(i, j)行优先存放，最后一个与第一个位置相同，
+    // 纹理坐标却是经度1，贴图在接缝处不会倒退一整圈；两极的每个三角扇各用一个顶点，
+    // 纹理坐标取所在一格的经度中点。纹理坐标us为经度/2π，vs从北极的0到南极的1
+    int columns = 2 * steps;
+    int count = 2 * columns + (steps - 1) * (columns + 1);
+    vertices.reserve(count);
+    us.clear();
+    vs.clear();
+    us.reserve(count);
+    vs.reserve(count);
+    for (int j = 0; j < columns; j++)
+    {
+        vertices.append(QVector3D(0, 0, -1));
+        us.append((j + 0.5f) / columns);
+        vs.append(1);
+    }
+    for (int i = 1; i < steps; i++)
+    {
+        double u = -PI / 2 + i * PI / steps;
+        for (int j = 0; j <= columns; j++)
+        {
+            double v = j * PI / steps;
+            vertices.append(QVector3D(cos(u) * cos(v), cos(u) * sin(v), sin(u)));
+            us.append(float(j) / columns);
+            vs.append(1 - float(i) / steps);
+        }
+    }
+    for (int j = 0; j < columns; j++)
+    {
+        vertices.append(QVector3D(0, 0, 1));
+        us.append((j + 0.5f) / columns);
+        vs.append(0);
+    }
+    int north = vertices.size() - columns;
+
+    xs.resize(vertices.size());
+    ys.resize(vertices.size());
+    zs.resize(vertices.size());
+    for (int i = 0; i < vertices.size(); i++)
+    {
+        xs[i] = vertices.at(i).x();
+        ys[i] = vertices.at(i).y();
+        zs[i] = vertices.at(i).z();
+    }
+
+    // 两极处是三角扇，中间每个网格分成两个三角形
+    indices.reserve(columns * (steps - 1) * 6);
+    for (int j = 0; j < columns; j++)
+    {
+        indices << j << columns + j + 1 << columns + j;
+        for (int i = 1; i < steps - 1; i++)
+        {
+            int r0 = columns + (i - 1) * (columns + 1), r1 = r0 + columns + 1;
+            indices << r0 + j << r1 + j + 1 << r1 + j;
+            indices << r0 + j << r0 + j + 1 << r1 + j + 1;
+        }
+        int r = columns + (steps - 2) * (columns + 1);
+        indices << r + j << r + j + 1 << north + j;
+    }
+}
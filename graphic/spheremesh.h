@@ -0,0 +1,24 @@
+#ifndef SPHEREMESH_H
+#define SPHEREMESH_H
+#include <QVector>
+#include <QVector3D>
+
+// 单位球面的三角网格：顶点既是位置也是外法向量，乘以半径即得实际坐标。
+// 与半径无关，同一细分级别的网格可以被所有球体图元共用
+struct SphereMesh
+{
+    SphereMesh() : level(0) {}
+
+    // 按经纬度参数化细分，每π弧度level步，level至少为2
+    void build(int level);
+
+    int triangleCount() const { return indices.size() / 3; }
+
+    int level;
+    QVector<QVector3D> vertices;
+    QVector<float> xs, ys, zs; // 顶点坐标按分量分开存放，供批量变换连续读取
+    QVector<float> us, vs; // 顶点的经纬度纹理坐标
+    QVector<int> indices; // 每3个下标组成一个三角形
+};
+
+#endif // SPHEREMESH_H
@@ -0,0 +1,21 @@
+TEMPLATE = app
+TARGET = tst_graphic
+
+QT += testlib gui
+QT -= qml quick
+
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+INCLUDEPATH += ..
+
+# 光照内核的各指令集实现要与标量实现按相同的次序运算，不能合并成乘加指令
+*-g++*|*-clang*: QMAKE_CXXFLAGS += -ffp-contract=off
+
+SOURCES += tst_graphic.cpp \
+    ../shadekernel.cpp
+
+HEADERS += \
+    ../rasterizer.h \
+    ../shadekernel.h \
+    ../shadesimd.h
@@ -0,0 +1,681 @@
+#include <QtTest>
+#include <QSet>
+#include <QHash>
+#include "rasterizer.h"
+#include "shadekernel.h"
+
+// 只记录写过的像素，用于比较两种算法画出的像素集合
+struct PixelSet
+{
+    inline void plot(int x, int y) { pixels.insert((qint64(x) << 32) | quint32(y)); }
+    inline void hline(int x0, int x1, int y)
+    {
+        for (int x = x0; x <= x1; x++)
+            plot(x, y);
+    }
+    inline void vline(int x, int y0, int y1)
+    {
+        for (int y = y0; y <= y1; y++)
+            plot(x, y);
+    }
+
+    inline bool contains(int x, int y) const { return pixels.contains((qint64(x) << 32) | quint32(y)); }
+
+    // 只保留clip内的像素
+    QSet<qint64> clipped(const QRect &clip) const
+    {
+        QSet<qint64> result;
+        foreach (qint64 p, pixels)
+        {
+            if (clip.contains(int(p >> 32), int(quint32(p))))
+                result.insert(p);
+        }
+        return result;
+    }
+
+    QSet<qint64> pixels;
+};
+
+// 原来逐点的Bresenham画线，作为run-slice实现的参照
+static void bresenham(PixelSet &sink, int x1, int y1, int x2, int y2)
+{
+    int x = x1, y = y1;
+    int dx = abs(x2 - x1), dy = abs(y2 - y1);
+    sink.plot(x, y);
+    sink.plot(x2, y2);
+    int sx = x2 < x1 ? -1 : 1, sy = y2 < y1 ? -1 : 1;
+    if (dx == 0 || dy == 0 || dx == dy)
+    {
+        while (x != x2 || y != y2)
+        {
+            sink.plot(x, y);
+            x += dx ? sx : 0;
+            y += dy ? sy : 0;
+        }
+        return;
+    }
+
+    if (dy < dx)
+    {
+        int p = 2 * dy - dx;
+        while (x != x2)
+        {
+            x += sx;
+            if (p < 0)
+            {
+                p += 2 * dy;
+            }
+            else
+            {
+                y += sy;
+                p += 2 * (dy - dx);
+            }
+            sink.plot(x, y);
+        }
+        return;
+    }
+    int p = 2 * dx - dy;
+    while (y != y2)
+    {
+        y += sy;
+        if (p < 0)
+        {
+            p += 2 * dx;
+        }
+        else
+        {
+            x += sx;
+            p += 2 * (dx - dy);
+        }
+        sink.plot(x, y);
+    }
+}
+
+class GraphicTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void lines();
+    void clippedLines();
+    void polygonFill();
+    void ellipseFill();
+    void triangleMesh();
+    void shadeKernels();
+    void flatMaterial();
+    void extraLights();
+    void lightTable();
+};
+
+// 随机线段的长度分三档：跨出画布的长线、普通线段和只有几个像素的短线
+static QLineF randomLine(int i)
+{
+    int range = i % 3 == 0 ? 2000 : (i % 3 == 1 ? 40 : 6);
+    int x1 = qrand() % range - range / 2, y1 = qrand() % range - range / 2;
+    int x2 = qrand() % range - range / 2, y2 = qrand() % range - range / 2;
+    return QLineF(x1, y1, x2, y2);
+}
+
+// run-slice画出的像素与Bresenham完全相同
+void GraphicTest::lines()
+{
+    qsrand(3);
+    for (int i = 0; i < 200000; i++)
+    {
+        QLineF line = randomLine(i);
+        PixelSet expected, actual;
+        bresenham(expected, line.x1(), line.y1(), line.x2(), line.y2());
+        drawLine(actual, line);
+        if (actual.pixels != expected.pixels)
+            QFAIL(qPrintable(QString("line (%1, %2)-(%3, %4)")
+                             .arg(line.x1()).arg(line.y1()).arg(line.x2()).arg(line.y2())));
+    }
+}
+
+// 批量裁剪后只光栅化可见的行，clip内的像素仍与Bresenham相同
+void GraphicTest::clippedLines()
+{
+    qsrand(5);
+    QRect clip(-300, -200, 600, 400);
+    const int count = 20000;
+    QVector<QLineF> lines;
+    for (int i = 0; i < count; i++)
+        lines.append(randomLine(i));
+
+    for (int i = 0; i < count; i++)
+    {
+        const QLineF &line = lines.at(i);
+        PixelSet expected, actual;
+        bresenham(expected, line.x1(), line.y1(), line.x2(), line.y2());
+        drawLine(actual, line, clip);
+        if (actual.clipped(clip) != expected.clipped(clip))
+            QFAIL(qPrintable(QString("line (%1, %2)-(%3, %4)")
+                             .arg(line.x1()).arg(line.y1()).arg(line.x2()).arg(line.y2())));
+    }
+
+    // 8条一批时每条线的结果与单独画相同
+    PixelSet batched, single;
+    drawLines(batched, lines.constData(), count, clip);
+    for (int i = 0; i < count; i++)
+        drawLine(single, lines.at(i), clip);
+    QVERIFY(batched.clipped(clip) == single.clipped(clip));
+}
+
+// 像素中心(x, y)按奇偶规则是否在整数顶点的多边形内：每条边覆盖 ylow <= y < yhigh 的行，
+// 交点不在像素中心右边的边数为奇数时在内，与fillPolygon的左闭右开一致，用整数精确判断
+static bool insidePolygon(const QVector<QPointF> &points, int x, int y)
+{
+    int n = points.size(), crossings = 0;
+    for (int i = 0; i < n; i++)
+    {
+        qint64 ax = points.at(i).x(), ay = points.at(i).y();
+        qint64 bx = points.at((i + 1) % n).x(), by = points.at((i + 1) % n).y();
+        if (ay > by)
+        {
+            qSwap(ax, bx);
+            qSwap(ay, by);
+        }
+        if (y < ay || y >= by)
+            continue;
+        if (ax * (by - ay) + (y - ay) * (bx - ax) <= x * (by - ay))
+            crossings++;
+    }
+    return crossings % 2 == 1;
+}
+
+// 原来的三角形填充：用Bresenham画出三条边，每行在最左、最右的边像素之间填满，
+// 两端再各多填一个像素；一行只有一个边像素时不填。outline为画出的边
+static void oldFillTriangle(PixelSet &sink, PixelSet &outline, const QPointF &p1, const QPointF &p2, const QPointF &p3)
+{
+    bresenham(outline, p1.x(), p1.y(), p2.x(), p2.y());
+    bresenham(outline, p2.x(), p2.y(), p3.x(), p3.y());
+    bresenham(outline, p3.x(), p3.y(), p1.x(), p1.y());
+    int xmin = qMin(qMin(p1.x(), p2.x()), p3.x()), xmax = qMax(qMax(p1.x(), p2.x()), p3.x());
+    int ymin = qMin(qMin(p1.y(), p2.y()), p3.y()), ymax = qMax(qMax(p1.y(), p2.y()), p3.y());
+    for (int y = ymin - 1; y <= ymax + 1; y++)
+    {
+        int xb = xmin, xe = xmax, count = 0;
+        for (int x = xmin - 1; x <= xmax + 1; x++)
+        {
+            if (!outline.contains(x, y))
+                continue;
+            if (count++ == 0)
+                xb = x;
+            else
+                xe = x;
+        }
+        if (count >= 2)
+            sink.hline(xb - 1, xe + 1, y);
+    }
+}
+
+// 多边形填充与逐像素按奇偶规则判断像素中心的结果完全相同，顶点与鼠标点出的一样取整数，
+// 包括凹的和自交的多边形。三角形再与原来的填充比较：原来每行多填出边线外的一个像素，
+// 只有一个边像素的行不填，除此之外两者相同
+void GraphicTest::polygonFill()
+{
+    qsrand(19);
+    for (int i = 0; i < 3000; i++)
+    {
+        int range = i % 2 ? 20 : 120;
+        int n = 3 + qrand() % 8;
+        QVector<QPointF> points;
+        for (int k = 0; k < n; k++)
+            points.append(QPointF(qrand() % range, qrand() % range));
+
+        PixelSet expected, actual;
+        for (int y = -1; y <= range; y++)
+        {
+            for (int x = -1; x <= range; x++)
+            {
+                if (insidePolygon(points, x, y))
+                    expected.plot(x, y);
+            }
+        }
+        fillPolygon(actual, points, -1, range);
+        if (actual.pixels != expected.pixels)
+            QFAIL(qPrintable(QString("polygon %1").arg(i)));
+
+        QVector<QPointF> triangle;
+        triangle << points.at(0) << points.at(1) << points.at(2);
+        PixelSet filled, old, outline;
+        fillPolygon(filled, triangle, -1, range);
+        oldFillTriangle(old, outline, triangle.at(0), triangle.at(1), triangle.at(2));
+        QHash<int, int> rowCount;
+        foreach (qint64 p, outline.pixels)
+            rowCount[int(quint32(p))]++;
+        foreach (qint64 p, filled.pixels)
+        {
+            if (!old.pixels.contains(p) && rowCount.value(int(quint32(p))) >= 2)
+                QFAIL(qPrintable(QString("triangle %1: pixel (%2, %3) not filled before")
+                                 .arg(i).arg(int(p >> 32)).arg(int(quint32(p)))));
+        }
+        foreach (qint64 p, old.pixels)
+        {
+            int x = int(p >> 32), y = int(quint32(p));
+            bool near = false;
+            for (int dy = -1; dy <= 1; dy++)
+            {
+                for (int dx = -1; dx <= 1; dx++)
+                    near = near || outline.contains(x + dx, y + dy);
+            }
+            if (!filled.pixels.contains(p) && !near)
+                QFAIL(qPrintable(QString("triangle %1: pixel (%2, %3) no longer filled")
+                                 .arg(i).arg(x).arg(y)));
+        }
+    }
+}
+
+// 原来的种子填充：从点击点向左右填满一段，再从这一段的左端起在上下两行各找一个种子，
+// 判定与fillEllipse相同。画布为width×height
+static void oldFillEllipse(PixelSet &sink, int x1, int y1, int xc, int yc, float ra, float rb, float ang,
+                           int width, int height)
+{
+    float cosa, sina;
+    ellipseAngle(ang, cosa, sina);
+    QVector<QPoint> seeds;
+    seeds.append(QPoint(x1, y1));
+    while (!seeds.isEmpty())
+    {
+        QPoint p = seeds.last();
+        seeds.pop_back();
+        int x = p.x(), y = p.y();
+        sink.plot(x, y);
+        int x0 = x + 1;
+        while (x0 < width && !sink.contains(x0, y) && inEllipse(x0 - xc, y - yc, cosa, sina, ra, rb))
+            sink.plot(x0++, y);
+        x0 = x - 1;
+        while (x0 >= 0 && !sink.contains(x0, y) && inEllipse(x0 - xc, y - yc, cosa, sina, ra, rb))
+            sink.plot(x0--, y);
+        int xl = x0 + 1;
+        for (int dy = 1; dy >= -1; dy -= 2)
+        {
+            int yn = y + dy;
+            x = xl;
+            while (x < width && (!inEllipse(x - xc, yn - yc, cosa, sina, ra, rb) || sink.contains(x, yn)))
+                x++;
+            if (yn >= 0 && yn < height && !sink.contains(x, yn) && inEllipse(x - xc, yn - yc, cosa, sina, ra, rb))
+                seeds.append(QPoint(x, yn));
+        }
+    }
+}
+
+// 椭圆填充的像素正好是clip内满足inEllipse判定的全部像素，包括很扁的和转角为90°倍数的椭圆。
+// 点击点在椭圆内时与原来的种子填充比较：它在上下两行各只找一个种子，有的段填不到，
+// 但填到的都在这次的结果里
+void GraphicTest::ellipseFill()
+{
+    qsrand(23);
+    const int width = 1040, height = 666;
+    for (int i = 0; i < 400; i++)
+    {
+        float ra = 1 + qrand() % (i % 4 == 0 ? 5 : 200), rb = 1 + qrand() % 150;
+        float ang = i % 5 == 0 ? qrand() % 4 * 90 : qrand() % 360;
+        int xc = 205 + qrand() % 630, yc = 205 + qrand() % 256;
+        int x1 = xc + qrand() % 3 - 1, y1 = yc + qrand() % 3 - 1;
+        QRect canvas(0, 0, width, height);
+        QRect clip = i % 3 == 0 ? QRect(100, 80, 700, 400) : canvas;
+
+        float cosa, sina;
+        ellipseAngle(ang, cosa, sina);
+        bool clicked = inEllipse(x1 - xc, y1 - yc, cosa, sina, ra, rb);
+        PixelSet expected, actual;
+        if (!clicked)
+        {
+            expected.plot(x1, y1);
+        }
+        else
+        {
+            int r = int(qMax(ra, rb)) + 4;
+            QRect box = QRect(xc - r, yc - r, 2 * r + 1, 2 * r + 1) & clip;
+            for (int y = box.top(); y <= box.bottom(); y++)
+            {
+                for (int x = box.left(); x <= box.right(); x++)
+                {
+                    if (inEllipse(x - xc, y - yc, cosa, sina, ra, rb))
+                        expected.plot(x, y);
+                }
+            }
+        }
+        fillEllipse(actual, x1, y1, xc, yc, ra, rb, ang, clip);
+        if (actual.pixels != expected.pixels)
+            QFAIL(qPrintable(QString("ellipse %1: ra %2, rb %3, angle %4").arg(i).arg(ra).arg(rb).arg(ang)));
+
+        if (clip != canvas || !clicked)
+            continue;
+        PixelSet old;
+        oldFillEllipse(old, x1, y1, xc, yc, ra, rb, ang, width, height);
+        foreach (qint64 p, old.pixels)
+        {
+            if (!actual.pixels.contains(p))
+                QFAIL(qPrintable(QString("ellipse %1: pixel (%2, %3) no longer filled")
+                                 .arg(i).arg(int(p >> 32)).arg(int(quint32(p)))));
+        }
+    }
+}
+
+static float randomUnit()
+{
+    return qrand() / float(RAND_MAX) * 2 - 1;
+}
+
+// 记录fillTriangle覆盖每个像素的次数
+struct Coverage
+{
+    inline void span(int y, int x0, int x1, const Barycentric &)
+    {
+        for (int x = x0; x <= x1; x++)
+            count[(qint64(x) << 32) | quint32(y)]++;
+    }
+
+    QHash<qint64, int> count;
+};
+
+// 以1/16像素为单位的整数坐标，与fillTriangle的定点数相同，下面的判断都是精确的
+struct FixedPoint
+{
+    qint64 x, y;
+};
+
+static qint64 cross(const FixedPoint &a, const FixedPoint &b, const FixedPoint &p)
+{
+    return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+// p在线段ab上，含端点
+static bool onSegment(const FixedPoint &a, const FixedPoint &b, const FixedPoint &p)
+{
+    return cross(a, b, p) == 0 && p.x >= qMin(a.x, b.x) && p.x <= qMax(a.x, b.x)
+            && p.y >= qMin(a.y, b.y) && p.y <= qMax(a.y, b.y);
+}
+
+// p在三角形abc内或边上，不论abc的方向
+static bool inTriangle(const FixedPoint &a, const FixedPoint &b, const FixedPoint &c, const FixedPoint &p)
+{
+    qint64 d0 = cross(a, b, p), d1 = cross(b, c, p), d2 = cross(c, a, p);
+    return (d0 >= 0 && d1 >= 0 && d2 >= 0) || (d0 <= 0 && d1 <= 0 && d2 <= 0);
+}
+
+static QPointF toPointF(const FixedPoint &p)
+{
+    return QPointF(p.x / 16.0, p.y / 16.0);
+}
+
+// 把互不重叠的三角形（每三个顶点一个）逐个交给fillTriangle，检查每个像素被覆盖的次数：
+// 中心在并集内部的像素恰好一次，包括落在三角形之间共用的边和顶点上的；
+// 在外边界上的至多一次，在外面的没有。outline为外边界上的线段，每两个点一条。
+// 全部正确时返回空串
+static QString checkCoverage(const QVector<FixedPoint> &triangles, const QVector<FixedPoint> &outline)
+{
+    Coverage coverage;
+    QRect clip(-4096, -4096, 8192, 8192);
+    qint64 left = triangles.at(0).x, right = left, top = triangles.at(0).y, bottom = top;
+    for (int t = 0; t + 2 < triangles.size(); t += 3)
+    {
+        fillTriangle(coverage, toPointF(triangles.at(t)), toPointF(triangles.at(t + 1)),
+                     toPointF(triangles.at(t + 2)), clip);
+        for (int k = t; k < t + 3; k++)
+        {
+            left = qMin(left, triangles.at(k).x);
+            right = qMax(right, triangles.at(k).x);
+            top = qMin(top, triangles.at(k).y);
+            bottom = qMax(bottom, triangles.at(k).y);
+        }
+    }
+
+    QRect box(QPoint(int(left / 16) - 1, int(top / 16) - 1), QPoint(int(right / 16) + 1, int(bottom / 16) + 1));
+    for (QHash<qint64, int>::const_iterator it = coverage.count.constBegin(); it != coverage.count.constEnd(); ++it)
+    {
+        int x = int(it.key() >> 32), y = int(quint32(it.key()));
+        if (!box.contains(x, y))
+            return QString("pixel (%1, %2) outside the mesh").arg(x).arg(y);
+    }
+    for (int y = box.top(); y <= box.bottom(); y++)
+    {
+        for (int x = box.left(); x <= box.right(); x++)
+        {
+            FixedPoint p = { x * 16, y * 16 };
+            bool boundary = false, inside = false;
+            for (int k = 0; k + 1 < outline.size() && !boundary; k += 2)
+                boundary = onSegment(outline.at(k), outline.at(k + 1), p);
+            for (int t = 0; t + 2 < triangles.size() && !inside; t += 3)
+                inside = inTriangle(triangles.at(t), triangles.at(t + 1), triangles.at(t + 2), p);
+            int n = coverage.count.value((qint64(x) << 32) | quint32(y));
+            if (boundary ? n > 1 : n != (inside ? 1 : 0))
+                return QString("pixel (%1, %2) covered %3 times").arg(x).arg(y).arg(n);
+        }
+    }
+    return QString();
+}
+
+// 随机的定点坐标，一半的情形取整像素，顶点正好落在像素中心上，最容易出现重复或遗漏
+static qint64 randomFixed(int pixels, bool whole)
+{
+    qint64 v = qrand() % (pixels * 16);
+    return whole ? v / 16 * 16 : v;
+}
+
+// 三角扇和三角带：相邻三角形共用边，左上规则下每个像素恰好属于一个三角形。
+// 三角形的顶点顺序随机取正反两种
+void GraphicTest::triangleMesh()
+{
+    qsrand(17);
+    for (int i = 0; i < 1000; i++)
+    {
+        bool whole = i % 2 == 0;
+        QVector<FixedPoint> triangles, outline;
+
+        // 绕中心一周的三角扇，外边界是周围的顶点连成的多边形
+        FixedPoint c = { randomFixed(200, whole), randomFixed(200, whole) };
+        int m = 3 + qrand() % 20;
+        double radius = (3 + qrand() % 40) * 16;
+        QVector<FixedPoint> ring(m);
+        bool valid = true;
+        for (int k = 0; k < m; k++)
+        {
+            double angle = 2 * 3.14159265358979 * (k + 0.4 * randomUnit()) / m;
+            qint64 x = c.x + qint64(floor(radius * cos(angle) + 0.5));
+            qint64 y = c.y + qint64(floor(radius * sin(angle) + 0.5));
+            FixedPoint p = { whole ? x / 16 * 16 : x, whole ? y / 16 * 16 : y };
+            ring[k] = p;
+        }
+        for (int k = 0; k < m; k++)
+        {
+            const FixedPoint &a = ring.at(k), &b = ring.at((k + 1) % m);
+            // 取整后方向翻转的三角形会与相邻的重叠，这组不测
+            if (cross(c, a, b) <= 0)
+                valid = false;
+            triangles << c << a << b;
+            outline << a << b;
+        }
+        if (!valid)
+            continue;
+        for (int t = 0; t < triangles.size(); t += 6)
+            qSwap(triangles[t + 1], triangles[t + 2]);
+        QString error = checkCoverage(triangles, outline);
+        if (!error.isEmpty())
+            QFAIL(qPrintable(QString("fan %1: %2").arg(i).arg(error)));
+
+        // 上下两行顶点之间的三角带，两行都是水平的，一半的情形转置成竖直的
+        triangles.clear();
+        outline.clear();
+        int n = 2 + qrand() % 12;
+        qint64 y0 = randomFixed(200, whole), y1 = y0 + 16 + randomFixed(30, whole);
+        qint64 xa = randomFixed(200, whole), xb = xa + randomFixed(8, whole) - randomFixed(8, whole);
+        QVector<FixedPoint> upper(n), lower(n);
+        for (int k = 0; k < n; k++)
+        {
+            FixedPoint a = { xa, y0 }, b = { xb, y1 };
+            upper[k] = a;
+            lower[k] = b;
+            xa += (whole ? 16 : 1) + randomFixed(10, whole);
+            xb += (whole ? 16 : 1) + randomFixed(10, whole);
+        }
+        if (qrand() % 2)
+        {
+            for (int k = 0; k < n; k++)
+            {
+                qSwap(upper[k].x, upper[k].y);
+                qSwap(lower[k].x, lower[k].y);
+            }
+        }
+        for (int k = 0; k + 1 < n; k++)
+        {
+            triangles << upper.at(k) << lower.at(k) << upper.at(k + 1);
+            triangles << upper.at(k + 1) << lower.at(k + 1) << lower.at(k);
+            outline << upper.at(k) << upper.at(k + 1) << lower.at(k) << lower.at(k + 1);
+        }
+        outline << upper.at(0) << lower.at(0) << upper.at(n - 1) << lower.at(n - 1);
+        error = checkCoverage(triangles, outline);
+        if (!error.isEmpty())
+            QFAIL(qPrintable(QString("strip %1: %2").arg(i).arg(error)));
+    }
+}
+
+// 各指令集的光照内核与标量实现的颜色相差不超过一级，包括点光源、背光截断和纹素调制。
+// 像素数不是16的倍数，各实现末尾的标量部分也会用到
+void GraphicTest::shadeKernels()
+{
+    qsrand(7);
+    const int count = 10007;
+    QVector<float> nx(count), ny(count), nz(count);
+    QVector<QRgb> texels(count);
+    for (int i = 0; i < count; i++)
+    {
+        float x = randomUnit(), y = randomUnit(), z = randomUnit();
+        float len = sqrt(x * x + y * y + z * z) + 1e-6f;
+        nx[i] = x / len;
+        ny[i] = y / len;
+        nz[i] = z / len;
+        texels[i] = qRgb(qrand() % 256, qrand() % 256, qrand() % 256);
+    }
+
+    ShadeLight lights[4] = {
+        { false, false, 0.6f, 0, 0.8f, 0.3f, 0.4f, 0.866f, 228, 228, 228 },
+        { true, true, 2, -1, 1.5f, 0.5f, -0.2f, 0.84f, 200, 40, 40 },
+        { false, true, -0.6f, 0, 0.8f, -0.3f, 0, 0.95f, 30, 60, 220 },
+        { true, true, 0.1f, 0.2f, 1.01f, 0, 0, 1, 100, 100, 0 }
+    };
+    ShadeParams p = { lights, 4, 0, 0, 1, 114, 0.8f, 0.3f, 3, 0, 0, 200, 100, 50, 0 };
+    phongRange(p);
+
+    const ShadeIsa isas[] = { ShadeSSE2, ShadeAVX2, ShadeAVX512 };
+    for (int t = 0; t < 2; t++)
+    {
+        const QRgb *tex = t ? texels.constData() : 0;
+        QVector<QRgb> expected(count);
+        shadeLights(shadeKernelScalar(), p, nx.constData(), ny.constData(), nz.constData(),
+                    tex, count, expected.data());
+        for (int k = 0; k < 3; k++)
+        {
+            const ShadeKernel *kernel = shadeKernelFor(isas[k]);
+            if (!kernel)
+                continue;
+            QVector<QRgb> actual(count);
+            shadeLights(*kernel, p, nx.constData(), ny.constData(), nz.constData(),
+                        tex, count, actual.data());
+            for (int i = 0; i < count; i++)
+            {
+                QRgb a = actual.at(i), e = expected.at(i);
+                if (qAbs(qRed(a) - qRed(e)) > 1 || qAbs(qGreen(a) - qGreen(e)) > 1
+                        || qAbs(qBlue(a) - qBlue(e)) > 1 || qAlpha(a) != qAlpha(e))
+                    QFAIL(qPrintable(QString("kernel %1, texels %2, pixel %3").arg(k).arg(t).arg(i)));
+            }
+        }
+    }
+}
+
+// 没有漫反射时，镜面反射系数或指数为零的材质亮度处处相同，归一化区间不能退化
+void GraphicTest::flatMaterial()
+{
+    ShadeLight light = { false, true, 0, 0, 1, 0, 0, 1, 228, 228, 228 };
+    ShadeParams p = { &light, 1, 0, 0, 1, 0, 0, 0.3f, 0, 0, 0, 200, 100, 50, 0 };
+    for (int k = 0; k < 2; k++)
+    {
+        p.specular = k ? 0 : 0.3f;
+        p.shininess = k ? 3 : 0;
+        phongRange(p);
+        QVERIFY(p.Imax - p.Imin >= 1);
+    }
+}
+
+// 主光源关掉只开一个添加的光源，或两者都开时，归一化后的亮度都不超过1，球面上没有截断的像素；
+// 方向光的最大值是实际取到的，最亮处接近1
+void GraphicTest::extraLights()
+{
+    qsrand(11);
+    const int count = 4096;
+    QVector<float> nx(count), ny(count), nz(count), I(count * 3);
+    for (int i = 0; i < count; i++)
+    {
+        float x = randomUnit(), y = randomUnit(), z = randomUnit();
+        float len = sqrt(x * x + y * y + z * z) + 1e-6f;
+        nx[i] = x / len;
+        ny[i] = y / len;
+        nz[i] = z / len;
+    }
+
+    ShadeLight lights[2] = {
+        { false, false, 0.6f, 0, 0.8f, 0.3f, 0, 0.954f, 0, 0, 0 },
+        { false, true, 0, 0, 1, 0, 0, 1, 228, 228, 228 }
+    };
+    ShadeParams p = { lights, 2, 0, 0, 1, 114, 0.8f, 0.3f, 2, 0, 0, 200, 100, 50, 0 };
+    for (int k = 0; k < 2; k++)
+    {
+        lights[0].r = lights[0].g = lights[0].b = k ? 228 : 0;
+        phongRange(p);
+        shadeIntensities(p, nx.constData(), ny.constData(), nz.constData(), count, I.data());
+        float brightest = 0;
+        for (int i = 0; i < count * 3; i++)
+        {
+            if (I.at(i) > 1 + 1e-5f)
+                QFAIL(qPrintable(QString("main light %1, pixel %2: %3").arg(k).arg(i / 3).arg(I.at(i))));
+            brightest = qMax(brightest, I.at(i));
+        }
+        if (k == 0)
+            QVERIFY(brightest > 0.99f);
+    }
+}
+
+// 推荐边长的光照查找表与直接计算的颜色最多差一级，镜面反射指数较大、高光很窄时也是
+void GraphicTest::lightTable()
+{
+    qsrand(13);
+    const int count = 20000;
+    QVector<float> nx(count), ny(count), nz(count);
+    for (int i = 0; i < count; i++)
+    {
+        float x = randomUnit(), y = randomUnit(), z = randomUnit();
+        float len = sqrt(x * x + y * y + z * z) + 1e-6f;
+        nx[i] = x / len;
+        ny[i] = y / len;
+        nz[i] = z / len;
+    }
+
+    ShadeLight light = { false, false, 0.6f, 0, 0.8f, 0.3f, 0, 0.954f, 228, 228, 228 };
+    ShadeParams p = { &light, 1, 0, 0, 1, 114, 0.8f, 0.3f, 2, 0, 0, 200, 100, 50, 0 };
+    const int shininess[] = { 2, 16, 64 };
+    for (int k = 0; k < 3; k++)
+    {
+        p.shininess = shininess[k];
+        p.specular = k ? 0.6f : 0.3f;
+        p.table = 0;
+        phongRange(p);
+        PhongTable table;
+        table.update(p, PhongTable::defaultSize);
+        p.table = &table;
+        QVector<QRgb> expected(count), actual(count);
+        shadePixelsScalar(p, nx.constData(), ny.constData(), nz.constData(), 0, count, expected.data());
+        shadePixelsTable(p, nx.constData(), ny.constData(), nz.constData(), 0, count, actual.data());
+        for (int i = 0; i < count; i++)
+        {
+            QRgb a = actual.at(i), e = expected.at(i);
+            if (qAbs(qRed(a) - qRed(e)) > 1 || qAbs(qGreen(a) - qGreen(e)) > 1 || qAbs(qBlue(a) - qBlue(e)) > 1)
+                QFAIL(qPrintable(QString("shininess %1, pixel %2").arg(p.shininess).arg(i)));
+        }
+    }
+}
+
+QTEST_APPLESS_MAIN(GraphicTest)
+
+#include "tst_graphic.moc"
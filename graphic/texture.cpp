@@ -0,0 +1,56 @@
+#include "texture.h"
+#include <math.h>
+
+// 逐级按2×2的平均缩小，奇数边长时最后一行、一列与前面的纹素一起平均，直到1×1
+Texture::Texture(const QImage &image)
+    : m_lodBias(0)
+{
+    if (image.isNull())
+        return;
+    QImage level = image.convertToFormat(QImage::Format_RGB32);
+    m_images.append(level);
+    while (level.width() > 1 || level.height() > 1)
+    {
+        int w = qMax(level.width() / 2, 1), h = qMax(level.height() / 2, 1);
+        QImage next(w, h, QImage::Format_RGB32);
+        for (int y = 0; y < h; y++)
+        {
+            const QRgb *r0 = reinterpret_cast<const QRgb *>(level.constScanLine(qMin(2 * y, level.height() - 1)));
+            const QRgb *r1 = reinterpret_cast<const QRgb *>(level.constScanLine(qMin(2 * y + 1, level.height() - 1)));
+            QRgb *dst = reinterpret_cast<QRgb *>(next.scanLine(y));
+            for (int x = 0; x < w; x++)
+            {
+                int x0 = qMin(2 * x, level.width() - 1), x1 = qMin(2 * x + 1, level.width() - 1);
+                dst[x] = qRgb((qRed(r0[x0]) + qRed(r0[x1]) + qRed(r1[x0]) + qRed(r1[x1]) + 2) / 4,
+                              (qGreen(r0[x0]) + qGreen(r0[x1]) + qGreen(r1[x0]) + qGreen(r1[x1]) + 2) / 4,
+                              (qBlue(r0[x0]) + qBlue(r0[x1]) + qBlue(r1[x0]) + qBlue(r1[x1]) + 2) / 4);
+            }
+        }
+        m_images.append(next);
+        level = next;
+    }
+
+    for (int k = 0; k < m_images.size(); k++)
+    {
+        const QImage &img = m_images.at(k);
+        Level l;
+        l.bits = reinterpret_cast<const QRgb *>(img.constBits());
+        l.width = img.width();
+        l.height = img.height();
+        l.stride = img.bytesPerLine() / sizeof(QRgb);
+        m_levels.append(l);
+    }
+    m_lodBias = 0.5f * log2(double(image.width()) * image.height());
+}
+
+QImage Texture::checkerboard(int columns, int rows, int cell)
+{
+    QImage image(columns * cell, rows * cell, QImage::Format_RGB32);
+    for (int y = 0; y < image.height(); y++)
+    {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < image.width(); x++)
+            line[x] = (x / cell + y / cell) % 2 ? qRgb(0, 0, 0) : qRgb(255, 255, 255);
+    }
+    return image;
+}
@@ -0,0 +1,68 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+#include <QImage>
+#include <QVector>
+#include <math.h>
+
+// 球面贴图：一幅图像和它逐级缩小一半的mipmap，按经纬度纹理坐标采样。
+// u沿经度方向，0和1都在经度0处，首尾相接重复；v从北极的0到南极的1，超出时取边缘的纹素
+class Texture
+{
+public:
+    Texture() : m_lodBias(0) {}
+    explicit Texture(const QImage &image);
+
+    bool isNull() const { return m_levels.isEmpty(); }
+
+    // 以(u, v)为中心采样。density为一个像素覆盖的纹理坐标面积以2为底的对数的一半，
+    // 加上原图尺寸后得到细节级别，取最接近的一级；smooth为真时在该级双线性插值，否则取最近的纹素
+    inline QRgb sample(float u, float v, float density, bool smooth) const
+    {
+        float lod = density + m_lodBias;
+        int k = lod <= 0 ? 0 : qMin(int(lod + 0.5f), m_levels.size() - 1);
+        const Level &level = m_levels.at(k);
+        float x = (u - floor(u)) * level.width, y = v * level.height;
+        if (!smooth)
+        {
+            int i = qMin(int(x), level.width - 1);
+            int j = qBound(0, int(y), level.height - 1);
+            return level.bits[j * level.stride + i];
+        }
+
+        // 纹素中心在半整数处
+        x -= 0.5f;
+        y -= 0.5f;
+        int i0 = int(floor(x)), j0 = int(floor(y));
+        float ax = x - i0, ay = y - j0;
+        int i1 = i0 + 1, j1 = j0 + 1;
+        i0 = i0 < 0 ? i0 + level.width : i0;
+        i1 = i1 >= level.width ? i1 - level.width : i1;
+        j0 = qBound(0, j0, level.height - 1);
+        j1 = qBound(0, j1, level.height - 1);
+        const QRgb *r0 = level.bits + j0 * level.stride, *r1 = level.bits + j1 * level.stride;
+        return blend(blend(r0[i0], r0[i1], ax), blend(r1[i0], r1[i1], ax), ay);
+    }
+
+    // 默认的棋盘格贴图：经度方向columns格，纬度方向rows格，每格cell个像素
+    static QImage checkerboard(int columns, int rows, int cell);
+
+private:
+    static inline QRgb blend(QRgb a, QRgb b, float t)
+    {
+        return qRgb(qRed(a) + (qRed(b) - qRed(a)) * t,
+                    qGreen(a) + (qGreen(b) - qGreen(a)) * t,
+                    qBlue(a) + (qBlue(b) - qBlue(a)) * t);
+    }
+
+    struct Level
+    {
+        const QRgb *bits;
+        int width, height, stride;
+    };
+
+    QVector<QImage> m_images; // 第0级为原图
+    QVector<Level> m_levels; // 各级图像的像素指针，采样时不经过QImage
+    float m_lodBias; // 原图尺寸对应的细节级别偏移
+};
+
+#endif // TEXTURE_H
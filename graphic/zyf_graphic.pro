@@ -2,8 +2,15 @@ TEMPLATE = app
 
 QT += qml quick widgets
 
+# 光照内核的各指令集实现要与标量实现按相同的次序运算，不能合并成乘加指令
+*-g++*|*-clang*: QMAKE_CXXFLAGS += -ffp-contract=off
+
 SOURCES += main.cpp \
-    painter.cpp
+    painter.cpp \
+    rastertarget.cpp \
+    spheremesh.cpp \
+    shadekernel.cpp \
+    texture.cpp
 
 RESOURCES += qml.qrc
 
@@ -15,4 +22,11 @@ OTHER_FILES += \
     ColorPicker.qml
 
 HEADERS += \
-    painter.h
+    painter.h \
+    rastertarget.h \
+    rasterizer.h \
+    spheremesh.h \
+    gbuffer.h \
+    shadekernel.h \
+    shadesimd.h \
+    texture.h